@@ -27,6 +27,7 @@ import re
 import time
 import subprocess
 import tempfile
+import hashlib
 
 from stat import *
 from cts import CTS
@@ -1825,6 +1826,106 @@ class SpecialTest1(CTSTest):
 AllTestClasses.append(SpecialTest1)
 
 
+class JournalReplayTest(CTSTest):
+    '''Check that a CIB journal is replayed only up to a bad record'''
+    def __init__(self, cm):
+        CTSTest.__init__(self,cm)
+        self.name = "JournalReplayTest"
+        self.start = StartTest(cm)
+        self.startall = SimulStartLite(cm)
+        self.stopall = SimulStopLite(cm)
+
+    def journal_record(self, version, target, changes):
+        '''Return a CIB journal record for a v2 patchset'''
+        patchset = ('<diff format="2"><version>'
+                    '<source admin_epoch="%d" epoch="%d" num_updates="%d"/>'
+                    '<target admin_epoch="%d" epoch="%d" num_updates="0"/>'
+                    '</version>%s</diff>'
+                    % (version[0], version[1], version[2],
+                       version[0], target, "".join(changes)))
+        digest = hashlib.md5(patchset.encode("utf-8")).hexdigest()
+        return "%d %s\n%s\n" % (len(patchset), digest, patchset)
+
+    def create_set(self, path, set_id):
+        '''Return a patchset change creating an empty property set'''
+        return ('<change operation="create" path="%s" position="0">'
+                '<cluster_property_set id="%s"/></change>' % (path, set_id))
+
+    def __call__(self, node):
+        '''Perform the 'JournalReplayTest' test. '''
+        self.incr("calls")
+
+        ret = self.stopall(None)
+        if not ret:
+            return self.failure("Could not stop all nodes")
+
+        cib_dir = CTSvars.CRM_CONFIG_DIR
+        (rc, lines) = self.rsh(node, "head -c 1024 %s/cib.xml" % cib_dir, None)
+        header = "".join(lines)
+        version = []
+        for field in [ "admin_epoch", "epoch", "num_updates" ]:
+            match = re.search(r'\b%s="(\d+)"' % field, header)
+            if match is None:
+                return self.failure("Could not read %s from the CIB on %s" % (field, node))
+            version.append(int(match.group(1)))
+
+        # The second record's first change would apply but its second would
+        # not, so neither it nor the record after it may be replayed
+        config = "/cib/configuration/crm_config"
+        records = [
+            self.journal_record(version, version[1] + 1,
+                                [ self.create_set(config, "cts-journal-1") ]),
+            self.journal_record([ version[0], version[1] + 1, 0 ], version[1] + 2,
+                                [ self.create_set(config, "cts-journal-2"),
+                                  self.create_set("/cib/configuration/cts-journal-missing",
+                                                  "cts-journal-2b") ]),
+            self.journal_record([ version[0], version[1] + 2, 0 ], version[1] + 3,
+                                [ self.create_set(config, "cts-journal-3") ]),
+        ]
+
+        (handle, journal) = tempfile.mkstemp(".cts")
+        os.write(handle, "".join(records).encode("utf-8"))
+        os.close(handle)
+        rc = self.rsh.cp(journal, "root@%s:%s/cib.journal" % (node, cib_dir))
+        os.unlink(journal)
+        if rc != 0:
+            return self.failure("Could not copy the CIB journal to %s" % node)
+        self.rsh(node, "chown %s:haclient %s/cib.journal"
+                 % (CTSvars.CRM_DAEMON_USER, cib_dir))
+
+        ret = self.start(node)
+        if not ret:
+            return self.failure("Could not start " + node)
+
+        (rc, lines) = self.rsh(node, "cibadmin -Q -o crm_config", None)
+        if rc != 0:
+            return self.failure("Could not query the CIB on %s" % node)
+        config = "".join(lines)
+        if "cts-journal-1" not in config:
+            return self.failure("Good journal record was not replayed on %s" % node)
+        for set_id in [ "cts-journal-2", "cts-journal-3" ]:
+            if set_id in config:
+                return self.failure("Journal record creating %s was replayed on %s"
+                                    % (set_id, node))
+
+        self.rsh(node, "cibadmin -D -o crm_config -X '<cluster_property_set id=\"cts-journal-1\"/>'")
+
+        ret = self.startall(None)
+        if not ret:
+            return self.failure("Could not start the remaining nodes")
+
+        return self.success()
+
+    def errorstoignore(self):
+        '''Return list of errors which should be ignored'''
+        return [
+            r"error.*: No create match for /cib/configuration/cts-journal-missing",
+            r"error.*: Could not apply record 2 from .*cib.journal",
+        ]
+
+AllTestClasses.append(JournalReplayTest)
+
+
 class HAETest(CTSTest):
     '''Set up a custom test to cause quorum failure issues for Andrew'''
     def __init__(self, cm):
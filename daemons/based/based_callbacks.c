@@ -14,6 +14,7 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
 
 #include <crm/crm.h>
@@ -22,6 +23,7 @@
 #include <crm/cluster/internal.h>
 
 #include <crm/common/xml.h>
+#include <crm/common/xml_internal.h>
 
 #include <pacemaker-based.h>
 
@@ -45,6 +47,7 @@ qb_ipcs_service_t *ipcs_shm = NULL;
 void send_cib_replace(const xmlNode * sync_request, const char *host);
 static void cib_process_request(xmlNode* request, gboolean force_synchronous,
                                 gboolean privileged, crm_client_t *cib_client);
+static void cib_batch_flush(void);
 
 
 int cib_process_command(xmlNode * request, xmlNode ** reply,
@@ -108,6 +111,7 @@ cib_ipc_closed(qb_ipcs_connection_t * c)
         return 0;
     }
     crm_trace("Connection %p", c);
+    cib_notify_forget_client(client);
     crm_client_destroy(client);
     return 0;
 }
@@ -181,6 +185,9 @@ cib_common_callback_worker(uint32_t id, uint32_t flags, xmlNode * op_request,
 
         } else if (safe_str_eq(type, T_CIB_REPLACE_NOTIFY)) {
             bit = cib_notify_replace;
+
+        } else if (safe_str_eq(type, T_CIB_DIFF_COALESCE)) {
+            bit = cib_notify_merge;
         }
 
         if (on_off) {
@@ -189,6 +196,16 @@ cib_common_callback_worker(uint32_t id, uint32_t flags, xmlNode * op_request,
             clear_bit(cib_client->options, bit);
         }
 
+        if (bit == cib_notify_diff) {
+            /* Each diff registration replaces any earlier filter */
+            const char *filter = NULL;
+
+            if (on_off) {
+                filter = crm_element_value(op_request, F_CIB_NOTIFY_FILTER);
+            }
+            cib_notify_set_filter(cib_client, filter);
+        }
+
         if (flags & crm_ipc_client_response) {
             /* TODO - include rc */
             crm_ipcs_send_ack(cib_client, id, flags, "ack", __FUNCTION__, __LINE__);
@@ -801,6 +818,9 @@ forward_request(xmlNode * request, crm_client_t * cib_client, int call_options)
     const char *host = crm_element_value(request, F_CIB_HOST);
 
     crm_xml_add(request, F_CIB_DELEGATED, cib_our_uname);
+    if (safe_str_eq(op, CIB_OP_SYNC_ONE)) {
+        cib_sync_add_version(request);
+    }
 
     if (host != NULL) {
         crm_trace("Forwarding %s op to %s", op, host);
@@ -813,6 +833,7 @@ forward_request(xmlNode * request, crm_client_t * cib_client, int call_options)
 
     /* Return the request to its original state */
     xml_remove_prop(request, F_CIB_DELEGATED);
+    xml_remove_prop(request, F_CIB_SYNC_VERSION);
 
     if (call_options & cib_discard_reply) {
         crm_trace("Client not interested in reply");
@@ -903,6 +924,11 @@ cib_process_request(xmlNode *request, gboolean force_synchronous,
     const char *client_name = crm_element_value(request, F_CIB_CLIENTNAME);
     const char *reply_to = crm_element_value(request, F_CIB_ISREPLY);
 
+    /* Anything else must be ordered after (and see the results of) any
+     * updates still waiting to be applied as a group
+     */
+    cib_batch_flush();
+
     if (cib_client) {
         from_peer = FALSE;
     }
@@ -1119,6 +1145,57 @@ cib_process_request(xmlNode *request, gboolean force_synchronous,
     return;
 }
 
+static mainloop_timer_t *digest_timer = NULL;
+
+/*!
+ * \internal
+ * \brief (Re)start the timer for comparing our CIB digest with our peers'
+ */
+static void
+restart_digest_timer(void)
+{
+    if (digest_timer == NULL) {
+        digest_timer = mainloop_timer_add("digester", 5000, FALSE, cib_digester_cb, NULL);
+    }
+    mainloop_timer_stop(digest_timer);
+    mainloop_timer_start(digest_timer);
+}
+
+/*!
+ * \internal
+ * \brief Create the reply to a CIB request
+ *
+ * \param[in] op            CIB operation requested
+ * \param[in] call_id       Caller's ID for the request
+ * \param[in] client_id     ID of client that made the request
+ * \param[in] call_options  Call options of the request
+ * \param[in] rc            Result of the request
+ * \param[in] call_data     Output of the request, if any (will be copied)
+ *
+ * \return Newly created reply (the caller is responsible for freeing it)
+ */
+static xmlNode *
+create_cib_reply(const char *op, const char *call_id, const char *client_id,
+                 int call_options, int rc, xmlNode *call_data)
+{
+    xmlNode *reply = create_xml_node(NULL, "cib-reply");
+
+    crm_xml_add(reply, F_TYPE, T_CIB);
+    crm_xml_add(reply, F_CIB_OPERATION, op);
+    crm_xml_add(reply, F_CIB_CALLID, call_id);
+    crm_xml_add(reply, F_CIB_CLIENTID, client_id);
+    crm_xml_add_int(reply, F_CIB_CALLOPTS, call_options);
+    crm_xml_add_int(reply, F_CIB_RC, rc);
+
+    if (call_data != NULL) {
+        crm_trace("Attaching reply output");
+        add_message_xml(reply, F_CIB_CALLDATA, call_data);
+    }
+
+    crm_log_xml_explicit(reply, "cib:reply");
+    return reply;
+}
+
 int
 cib_process_command(xmlNode * request, xmlNode ** reply, xmlNode ** cib_diff, gboolean privileged)
 {
@@ -1142,14 +1219,8 @@ cib_process_command(xmlNode * request, xmlNode ** reply, xmlNode ** cib_diff, gb
     gboolean config_changed = FALSE;
     gboolean manage_counters = TRUE;
 
-    static mainloop_timer_t *digest_timer = NULL;
-
     CRM_ASSERT(cib_status == pcmk_ok);
 
-    if(digest_timer == NULL) {
-        digest_timer = mainloop_timer_add("digester", 5000, FALSE, cib_digester_cb, NULL);
-    }
-
     *reply = NULL;
     *cib_diff = NULL;
     current_cib = the_cib;
@@ -1242,11 +1313,19 @@ cib_process_command(xmlNode * request, xmlNode ** reply, xmlNode ** cib_diff, gb
                   (is_set(call_options, cib_zero_copy)? " zero-copy" : ""),
                   (config_changed? " changed" : ""));
         if(is_not_set(call_options, cib_zero_copy)) {
-            rc = activateCibXml(result_cib, config_changed, op);
+            /* A journaled change doesn't need all of cib.xml to be written */
+            gboolean to_disk = config_changed
+                               && (cib_journal_append(*cib_diff, op) == FALSE);
+
+            rc = activateCibXml(result_cib, to_disk, op);
             crm_trace("Activated %s (%d)",
                       crm_element_value(current_cib, XML_ATTR_NUMUPDATES), rc);
         }
 
+        if (rc == pcmk_ok) {
+            cib_history_add(*cib_diff);
+        }
+
         if (rc == pcmk_ok && cib_internal_config_changed(*cib_diff)) {
             cib_read_config(config_hash, result_cib);
         }
@@ -1269,8 +1348,7 @@ cib_process_command(xmlNode * request, xmlNode ** reply, xmlNode ** cib_diff, gb
             send_r_notify = TRUE;
         }
 
-        mainloop_timer_stop(digest_timer);
-        mainloop_timer_start(digest_timer);
+        restart_digest_timer();
 
     } else if (rc == -pcmk_err_schema_validation) {
         CRM_ASSERT(is_not_set(call_options, cib_zero_copy));
@@ -1307,25 +1385,14 @@ cib_process_command(xmlNode * request, xmlNode ** reply, xmlNode ** cib_diff, gb
     if ((call_options & cib_discard_reply) == 0) {
         const char *caller = crm_element_value(request, F_CIB_CLIENTID);
 
-        *reply = create_xml_node(NULL, "cib-reply");
-        crm_xml_add(*reply, F_TYPE, T_CIB);
-        crm_xml_add(*reply, F_CIB_OPERATION, op);
-        crm_xml_add(*reply, F_CIB_CALLID, call_id);
-        crm_xml_add(*reply, F_CIB_CLIENTID, caller);
-        crm_xml_add_int(*reply, F_CIB_CALLOPTS, call_options);
-        crm_xml_add_int(*reply, F_CIB_RC, rc);
-
-        if (output != NULL) {
-            crm_trace("Attaching reply output");
-            add_message_xml(*reply, F_CIB_CALLDATA, output);
-        }
-
-        crm_log_xml_explicit(*reply, "cib:reply");
+        *reply = create_cib_reply(op, call_id, caller, call_options, rc,
+                                  output);
     }
 
     crm_trace("cleanup");
 
-    if (cib_op_modifies(call_type) == FALSE && output != current_cib) {
+    if ((cib_op_modifies(call_type) == FALSE) && (output != NULL)
+        && (output->doc != current_cib->doc)) {
         free_xml(output);
         output = NULL;
     }
@@ -1338,6 +1405,304 @@ cib_process_command(xmlNode * request, xmlNode ** reply, xmlNode ** cib_diff, gb
     return rc;
 }
 
+/* Status updates from peers (such as the flood of attribute and resource
+ * history updates during a mass failover) are queued and applied as a group,
+ * with one pass over the CIB to build the patchset and one diff notification,
+ * while each caller still gets its own reply and result code.
+ */
+#define CIB_BATCH_MAX_DEFAULT 100
+
+typedef struct cib_batch_op_s {
+    xmlNode *request;
+    xmlNode *input;
+    int call_options;
+    int rc;
+} cib_batch_op_t;
+
+static GList *batch_ops = NULL;         /* queued requests, in order */
+static int batch_length = 0;
+static GList *batch_applying = NULL;    /* requests being applied */
+static crm_trigger_t *batch_trigger = NULL;
+
+/*!
+ * \internal
+ * \brief Get the most updates that should be applied as one group
+ *
+ * \return PCMK_cib_batch_max if set, otherwise a default
+ *         (grouping is disabled if this is less than 2)
+ */
+static int
+cib_batch_max(void)
+{
+    static int max = -1;
+
+    if (max < 0) {
+        const char *value = daemon_option("cib_batch_max");
+
+        max = CIB_BATCH_MAX_DEFAULT;
+        if (value != NULL) {
+            long long parsed = crm_int_helper(value, NULL);
+
+            if ((errno != 0) || (parsed < 0) || (parsed > INT_MAX)) {
+                crm_warn("Ignoring invalid PCMK_cib_batch_max '%s'", value);
+            } else {
+                max = (int) parsed;
+            }
+        }
+    }
+    return max;
+}
+
+/*!
+ * \internal
+ * \brief Check whether a peer request can be applied as part of a group
+ *
+ * Only plain status section modifications qualify. These are applied in place
+ * and never need validating, and applying them together changes the CIB
+ * (including its version) exactly as applying them one by one would.
+ *
+ * \param[in] request  Request received from a peer
+ *
+ * \return TRUE if \p request can be queued, otherwise FALSE
+ */
+static gboolean
+cib_batch_eligible(xmlNode *request)
+{
+    int call_options = 0;
+    const char *host = crm_element_value(request, F_CIB_HOST);
+
+    if ((cib_batch_max() < 2) || stand_alone || cib_legacy_mode()
+        || (cib_status != pcmk_ok)) {
+        return FALSE;
+    }
+
+    if (safe_str_neq(crm_element_value(request, F_CIB_OPERATION), CIB_OP_MODIFY)
+        || safe_str_neq(crm_element_value(request, F_CIB_SECTION),
+                        XML_CIB_TAG_STATUS)
+        || ((host != NULL) && (host[0] != '\0'))
+        || (crm_element_value(request, F_CIB_ISREPLY) != NULL)
+        || crm_is_true(crm_element_value(request, F_CIB_GLOBAL_UPDATE))) {
+        return FALSE;
+    }
+
+    crm_element_value_int(request, F_CIB_CALLOPTS, &call_options);
+    if (call_options & (cib_dryrun|cib_inhibit_notify|cib_inhibit_bcast
+                        |cib_xpath)) {
+        return FALSE;
+    }
+
+#if ENABLE_ACL
+    /* Changes are checked against the ACLs of a single user */
+    if (pcmk_acl_required(crm_element_value(request, F_CIB_USER))) {
+        return FALSE;
+    }
+#endif
+    return TRUE;
+}
+
+static void
+cib_batch_op_free(gpointer data)
+{
+    cib_batch_op_t *batch_op = data;
+
+    free_xml(batch_op->request);
+    free(batch_op);
+}
+
+/*!
+ * \internal
+ * \brief Apply a group of queued status updates (as a CIB operation)
+ *
+ * This is passed to cib_perform_op() with cib_zero_copy set, so it applies
+ * each request in batch_applying to the live CIB, recording each one's result.
+ */
+static int
+cib_process_modify_batch(const char *op, int options, const char *section,
+                         xmlNode *req, xmlNode *input, xmlNode *existing_cib,
+                         xmlNode **result_cib, xmlNode **answer)
+{
+    int changes = 0;
+    GList *iter = NULL;
+
+    for (iter = batch_applying; iter != NULL; iter = iter->next) {
+        cib_batch_op_t *batch_op = iter->data;
+        xmlNode *batch_answer = NULL;
+
+        xml_document_set_dirty(*result_cib, FALSE);
+        batch_op->rc = cib_process_modify(op, batch_op->call_options, section,
+                                          batch_op->request, batch_op->input,
+                                          existing_cib, result_cib,
+                                          &batch_answer);
+        free_xml(batch_answer);
+
+        if (xml_document_dirty(*result_cib)) {
+            changes++;
+        }
+    }
+    xml_document_set_dirty(*result_cib, (changes > 0));
+
+    /* Each update that changed something would have incremented num_updates,
+     * and creating the patchset will add one
+     */
+    if (changes > 1) {
+        int updates = 0;
+
+        crm_element_value_int(*result_cib, XML_ATTR_NUMUPDATES, &updates);
+        crm_xml_add_int(*result_cib, XML_ATTR_NUMUPDATES, updates + changes - 1);
+    }
+    return pcmk_ok;
+}
+
+/*!
+ * \internal
+ * \brief Apply a group of queued status updates and reply to each
+ *
+ * \param[in] ops  Queued updates (as cib_batch_op_t *), in order
+ */
+static void
+cib_process_batch(GList *ops)
+{
+    int rc = pcmk_ok;
+    int call_type = 0;
+    GList *iter = NULL;
+    gboolean config_changed = FALSE;
+    const char *section = NULL;
+    xmlNode *result_cib = NULL;
+    xmlNode *cib_diff = NULL;
+    xmlNode *output = NULL;
+    cib_batch_op_t *last = g_list_last(ops)->data;
+
+    cib_get_operation_id(CIB_OP_MODIFY, &call_type);
+    for (iter = ops; iter != NULL; iter = iter->next) {
+        cib_batch_op_t *batch_op = iter->data;
+
+        crm_element_value_int(batch_op->request, F_CIB_CALLOPTS,
+                              &(batch_op->call_options));
+        batch_op->call_options |= cib_zero_copy;
+        cib_op_prepare(call_type, batch_op->request, &(batch_op->input),
+                       &section);
+    }
+
+    crm_trace("Applying %d queued status updates", g_list_length(ops));
+    ping_modified_since = TRUE;
+    batch_applying = ops;
+    rc = cib_perform_op(CIB_OP_MODIFY, last->call_options,
+                        cib_process_modify_batch, FALSE, XML_CIB_TAG_STATUS,
+                        last->request, NULL, TRUE, &config_changed, the_cib,
+                        &result_cib, &cib_diff, &output);
+    batch_applying = NULL;
+    free_xml(output);
+
+    if (rc == pcmk_ok) {
+        cib_history_add(cib_diff);
+        restart_digest_timer();
+    }
+    cib_diff_notify(last->call_options,
+                    crm_element_value(last->request, F_CIB_CLIENTNAME),
+                    crm_element_value(last->request, F_CIB_CALLID),
+                    CIB_OP_MODIFY, last->input, rc, cib_diff);
+    free_xml(cib_diff);
+
+    for (iter = ops; iter != NULL; iter = iter->next) {
+        cib_batch_op_t *batch_op = iter->data;
+        xmlNode *request = batch_op->request;
+        int op_rc = (rc == pcmk_ok)? batch_op->rc : rc;
+        const char *call_id = crm_element_value(request, F_CIB_CALLID);
+        const char *client_id = crm_element_value(request, F_CIB_CLIENTID);
+        const char *client_name = crm_element_value(request, F_CIB_CLIENTNAME);
+        const char *originator = crm_element_value(request, F_ORIG);
+        const char *delegated = crm_element_value(request, F_CIB_DELEGATED);
+
+        do_crm_log(((op_rc == pcmk_ok)? LOG_INFO : LOG_WARNING),
+                   "Completed %s operation for section %s: %s (rc=%d, origin=%s/%s/%s, version=%s.%s.%s)",
+                   CIB_OP_MODIFY, XML_CIB_TAG_STATUS, pcmk_strerror(op_rc),
+                   op_rc, originator ? originator : "local", client_name,
+                   call_id,
+                   crm_element_value(the_cib, XML_ATTR_GENERATION_ADMIN),
+                   crm_element_value(the_cib, XML_ATTR_GENERATION),
+                   crm_element_value(the_cib, XML_ATTR_NUMUPDATES));
+
+        if (safe_str_eq(delegated, cib_our_uname) && client_id
+            && is_not_set(batch_op->call_options, cib_discard_reply)) {
+            xmlNode *reply = create_cib_reply(CIB_OP_MODIFY, call_id,
+                                              client_id,
+                                              batch_op->call_options, op_rc,
+                                              NULL);
+
+            do_local_notify(reply, client_id,
+                            is_set(batch_op->call_options, cib_sync_call),
+                            TRUE);
+            free_xml(reply);
+        }
+    }
+}
+
+/*!
+ * \internal
+ * \brief Apply any queued status updates
+ */
+static void
+cib_batch_flush(void)
+{
+    GList *ops = batch_ops;
+
+    if (ops == NULL) {
+        return;
+    }
+    batch_ops = NULL;
+    batch_length = 0;
+
+    if ((ops->next == NULL) || (cib_status != pcmk_ok)) {
+        GList *iter = NULL;
+
+        // Nothing to gain from grouping
+        for (iter = ops; iter != NULL; iter = iter->next) {
+            cib_batch_op_t *batch_op = iter->data;
+
+            cib_process_request(batch_op->request, FALSE, TRUE, NULL);
+        }
+
+    } else {
+        cib_process_batch(ops);
+    }
+    g_list_free_full(ops, cib_batch_op_free);
+}
+
+static gboolean
+cib_batch_dispatch(gpointer user_data)
+{
+    cib_batch_flush();
+    return TRUE;
+}
+
+/*!
+ * \internal
+ * \brief Queue a status update from a peer to be applied as part of a group
+ *
+ * \param[in] request  Request received from a peer (will be copied)
+ */
+static void
+cib_batch_add(xmlNode *request)
+{
+    cib_batch_op_t *batch_op = calloc(1, sizeof(cib_batch_op_t));
+
+    CRM_ASSERT(batch_op != NULL);
+    batch_op->request = copy_xml(request);
+    batch_ops = g_list_append(batch_ops, batch_op);
+
+    if (++batch_length >= cib_batch_max()) {
+        cib_batch_flush();
+        return;
+    }
+
+    /* Let whatever else has already been delivered be queued too */
+    if (batch_trigger == NULL) {
+        batch_trigger = mainloop_add_trigger(G_PRIORITY_DEFAULT,
+                                             cib_batch_dispatch, NULL);
+    }
+    mainloop_set_trigger(batch_trigger);
+}
+
 void
 cib_peer_callback(xmlNode * msg, void *private_data)
 {
@@ -1363,6 +1728,10 @@ cib_peer_callback(xmlNode * msg, void *private_data)
     }
 
     /* crm_log_xml_trace("Peer[inbound]", msg); */
+    if (cib_batch_eligible(msg)) {
+        cib_batch_add(msg);
+        return;
+    }
     cib_process_request(msg, FALSE, TRUE, NULL);
     return;
 
@@ -1506,6 +1875,7 @@ terminate_cib(const char *caller, int fast)
         remote_tls_fd = 0;
     }
 
+    cib_batch_flush();
     uninitializeCib();
 
     if (fast > 0) {
@@ -231,7 +231,8 @@ cib_msg_copy(xmlNode * msg, gboolean with_data)
         F_CIB_USER,
 #endif
         F_CIB_NOTIFY_TYPE,
-        F_CIB_NOTIFY_ACTIVATE
+        F_CIB_NOTIFY_ACTIVATE,
+        F_CIB_NOTIFY_FILTER
     };
 
     static const char *data_list[] = {
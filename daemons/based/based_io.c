@@ -179,6 +179,539 @@ static int cib_archive_sort(const struct dirent ** a, const struct dirent **b)
     return rc;
 }
 
+/* Configuration changes are appended to a journal as v2 patchsets, so that
+ * each change costs one small synchronous append rather than a rewrite of all
+ * of cib.xml. The journal is folded into cib.xml (compacted) once it grows
+ * past a size limit, whenever a change can't be journaled, and at shutdown.
+ *
+ * When a write of cib.xml starts, the journal is renamed to CIB_JOURNAL_OLD
+ * and changes made after that point go to a new journal. The old journal is
+ * removed once the write succeeds. Each record is the length of the patchset
+ * XML and its MD5 digest on a line of their own, followed by the XML and a
+ * newline. The digest plays the part cib.xml.sig plays for cib.xml, so that a
+ * damaged record is not mistaken for a configuration change.
+ *
+ * Records form a chain: each is replayed only onto the configuration version
+ * it was made from. Once a change can't be journaled, nothing more is until
+ * the write of cib.xml that the change requires has started, otherwise later
+ * records would follow a change that is on disk nowhere.
+ */
+#define CIB_JOURNAL             "cib.journal"
+#define CIB_JOURNAL_OLD         "cib.journal.old"
+#define CIB_JOURNAL_MAX_DEFAULT (1024 * 1024)
+#define CIB_JOURNAL_DIGEST_LEN  32
+
+static int journal_fd = -1;
+static size_t journal_bytes = 0;
+static int journal_records = 0;
+static gboolean journal_gap = FALSE;
+
+/*!
+ * \internal
+ * \brief Get the journal size at which cib.xml should be rewritten
+ *
+ * \return PCMK_cib_journal_max if set, otherwise a default
+ *         (journaling is disabled if this is 0)
+ */
+static size_t
+cib_journal_max(void)
+{
+    static long long max = -1;
+
+    if (max < 0) {
+        const char *value = daemon_option("cib_journal_max");
+
+        max = CIB_JOURNAL_MAX_DEFAULT;
+        if (value != NULL) {
+            long long parsed = crm_int_helper(value, NULL);
+
+            if ((errno != 0) || (parsed < 0)) {
+                crm_warn("Ignoring invalid PCMK_cib_journal_max '%s'", value);
+            } else {
+                max = parsed;
+            }
+        }
+    }
+    return (size_t) max;
+}
+
+/*!
+ * \internal
+ * \brief Check whether a patchset change applies to the status section
+ *
+ * \param[in] change  Change from a v2 patchset
+ *
+ * \return TRUE if \p change only affects the status section
+ */
+static gboolean
+journal_change_is_status(xmlNode *change)
+{
+    static const char *prefix = "/" XML_TAG_CIB "/" XML_CIB_TAG_STATUS;
+    const char *path = crm_element_value(change, XML_DIFF_PATH);
+    size_t len = strlen(prefix);
+
+    if (path == NULL) {
+        return FALSE;
+    }
+    if ((strncmp(path, prefix, len) == 0)
+        && ((path[len] == '\0') || (path[len] == '/') || (path[len] == '['))) {
+        return TRUE;
+    }
+    if (safe_str_eq(path, "/" XML_TAG_CIB)
+        && safe_str_eq(crm_element_value(change, XML_DIFF_OP), "create")) {
+        xmlNode *created = __xml_first_child_element(change);
+
+        return created && crm_str_eq((const char *) created->name,
+                                     XML_CIB_TAG_STATUS, TRUE);
+    }
+    return FALSE;
+}
+
+/*!
+ * \internal
+ * \brief Compare the configuration versions in two version triples
+ *
+ * \return TRUE if \p a has a newer admin_epoch/epoch pair than \p b
+ */
+static gboolean
+journal_version_newer(const int a[3], const int b[3])
+{
+    return (a[0] > b[0]) || ((a[0] == b[0]) && (a[1] > b[1]));
+}
+
+/*!
+ * \internal
+ * \brief Write a configuration change to the CIB journal
+ *
+ * Status changes and the patchset digest are dropped from the record, because
+ * the status section is not preserved across restarts and the digest covers
+ * it.
+ *
+ * \param[in] patchset  Patchset describing the change
+ * \param[in] op        CIB operation that made the change (for logging)
+ *
+ * \return TRUE if the change was journaled, otherwise FALSE
+ */
+static gboolean
+journal_append_record(xmlNode *patchset, const char *op)
+{
+    int format = 1;
+    int add[] = { 0, 0, 0 };
+    int del[] = { 0, 0, 0 };
+    size_t len = 0;
+    size_t written = 0;
+    char *text = NULL;
+    char *digest = NULL;
+    char *record = NULL;
+    xmlNode *copy = NULL;
+    xmlNode *change = NULL;
+
+    if ((patchset == NULL) || (cib_journal_max() == 0)
+        || (cib_writes_enabled == FALSE) || (cib_status != pcmk_ok)) {
+        return FALSE;
+    }
+
+    crm_element_value_int(patchset, "format", &format);
+    if (format != 2) {
+        crm_trace("Not journaling v%d patchset for %s op", format, op);
+        return FALSE;
+    }
+
+    /* Replay skips records that are not newer than cib.xml, so anything that
+     * doesn't advance the configuration version (such as a replace with an
+     * older CIB) must be written in full.
+     */
+    xml_patch_versions(patchset, add, del);
+    if (journal_version_newer(add, del) == FALSE) {
+        crm_trace("Not journaling %s op that doesn't advance the version", op);
+        return FALSE;
+    }
+
+    if (journal_fd < 0) {
+        char *path = crm_concat(cib_root, CIB_JOURNAL, '/');
+
+        journal_fd = open(path, O_WRONLY|O_APPEND|O_CREAT, S_IRUSR|S_IWUSR);
+        if (journal_fd < 0) {
+            crm_perror(LOG_WARNING, "Could not open CIB journal %s", path);
+            free(path);
+            return FALSE;
+        }
+        free(path);
+        journal_bytes = (size_t) lseek(journal_fd, 0, SEEK_END);
+    }
+
+    copy = copy_xml(patchset);
+    xml_remove_prop(copy, XML_ATTR_DIGEST);
+    change = __xml_first_child_element(copy);
+    while (change != NULL) {
+        xmlNode *next = __xml_next_element(change);
+
+        if (journal_change_is_status(change)) {
+            free_xml(change);
+        }
+        change = next;
+    }
+
+    text = dump_xml_unformatted(copy);
+    free_xml(copy);
+    digest = crm_md5sum(text);
+    if (digest == NULL) {
+        free(text);
+        return FALSE;
+    }
+    record = crm_strdup_printf("%llu %s\n%s\n",
+                               (unsigned long long) strlen(text), digest, text);
+    free(digest);
+    free(text);
+
+    len = strlen(record);
+    while (written < len) {
+        ssize_t rc = write(journal_fd, record + written, len - written);
+
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += rc;
+    }
+    free(record);
+
+    if ((written < len) || (fsync(journal_fd) < 0)) {
+        crm_perror(LOG_WARNING,
+                   "Could not journal %s op, writing full CIB instead", op);
+
+        /* Don't leave a partial record for later ones to follow */
+        if (ftruncate(journal_fd, journal_bytes) < 0) {
+            crm_perror(LOG_WARNING, "Could not truncate CIB journal");
+        }
+        close(journal_fd);
+        journal_fd = -1;
+        return FALSE;
+    }
+
+    journal_bytes += len;
+    journal_records++;
+    crm_trace("Journaled %s op as %llu-byte record (%d records, %llu bytes)",
+              op, (unsigned long long) len, journal_records,
+              (unsigned long long) journal_bytes);
+
+    if (journal_bytes >= cib_journal_max()) {
+        crm_debug("Compacting CIB journal of %d records", journal_records);
+        mainloop_set_trigger(cib_writer);
+    }
+    return TRUE;
+}
+
+/*!
+ * \internal
+ * \brief Durably record a configuration change in the CIB journal
+ *
+ * \param[in] patchset  Patchset describing the change
+ * \param[in] op        CIB operation that made the change (for logging)
+ *
+ * \return TRUE if the change was journaled, otherwise FALSE (in which case the
+ *         caller must arrange for all of cib.xml to be written)
+ */
+gboolean
+cib_journal_append(xmlNode *patchset, const char *op)
+{
+    if (journal_gap) {
+        crm_trace("Not journaling %s op until the CIB has been written", op);
+        return FALSE;
+    }
+    if (journal_append_record(patchset, op) == FALSE) {
+        journal_gap = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*!
+ * \internal
+ * \brief Start a new CIB journal before writing all of cib.xml
+ *
+ * Records already in the current journal are moved to the old journal, which
+ * can be removed once the write succeeds.
+ */
+static void
+cib_journal_rotate(void)
+{
+    char *path = crm_concat(cib_root, CIB_JOURNAL, '/');
+    char *old_path = crm_concat(cib_root, CIB_JOURNAL_OLD, '/');
+    char *contents = NULL;
+
+    if (journal_fd >= 0) {
+        close(journal_fd);
+        journal_fd = -1;
+    }
+    journal_bytes = 0;
+    journal_records = 0;
+
+    // The write about to start covers any change that wasn't journaled
+    journal_gap = FALSE;
+
+    if (access(path, F_OK) < 0) {
+        // Nothing journaled since the last write
+
+    } else if (access(old_path, F_OK) < 0) {
+        if (rename(path, old_path) < 0) {
+            crm_perror(LOG_WARNING, "Could not rename %s to %s",
+                       path, old_path);
+        }
+
+    } else {
+        /* A previous write didn't complete (we must have restarted since), so
+         * keep both sets of records until this one does.
+         */
+        contents = crm_read_contents(path);
+        if (contents != NULL) {
+            // crm_write_sync() closes fd
+            int fd = open(old_path, O_WRONLY|O_APPEND);
+
+            if ((fd < 0) || (crm_write_sync(fd, contents) < 0)) {
+                crm_perror(LOG_WARNING, "Could not append %s to %s",
+                           path, old_path);
+                goto done;
+            }
+        }
+        unlink(path);
+    }
+
+done:
+    free(contents);
+    free(path);
+    free(old_path);
+}
+
+/*!
+ * \internal
+ * \brief Remove journal records that are now part of cib.xml
+ */
+static void
+cib_journal_written(void)
+{
+    char *old_path = crm_concat(cib_root, CIB_JOURNAL_OLD, '/');
+
+    if ((unlink(old_path) < 0) && (errno != ENOENT)) {
+        crm_perror(LOG_WARNING, "Could not remove %s", old_path);
+    }
+    free(old_path);
+}
+
+/*!
+ * \internal
+ * \brief Apply the records in one CIB journal file
+ *
+ * \param[in]     path       Journal file to read
+ * \param[in,out] xml        CIB to apply records to
+ * \param[in,out] processed  Number of records handled without error so far
+ * \param[in]     limit      Stop after this many records (-1 for no limit)
+ * \param[in,out] applied    Number of records applied so far
+ *
+ * \return pcmk_ok if the whole file was processed, -ENODATA if processing
+ *         stopped at an unreadable or out-of-sequence record or the limit
+ *         (\p xml is intact), otherwise the error from applying a record
+ *         (\p xml is unusable)
+ * \note Records that are not newer than \p xml are skipped, because they are
+ *       already part of it. A newer record is applied only if it was made from
+ *       the configuration version \p xml has. The patchset's own version check
+ *       can't be used, because num_updates in cib.xml reflects status changes
+ *       that are not journaled.
+ */
+static int
+journal_apply_file(const char *path, xmlNode *xml, int *processed, int limit,
+                   int *applied)
+{
+    char *contents = crm_read_contents(path);
+    size_t remaining = 0;
+    char *pos = contents;
+    int rc = pcmk_ok;
+
+    if (contents == NULL) {
+        return pcmk_ok;
+    }
+    remaining = strlen(contents);
+
+    while ((rc == pcmk_ok) && (remaining > 0)) {
+        int add[] = { 0, 0, 0 };
+        int del[] = { 0, 0, 0 };
+        int current[] = { 0, 0, 0 };
+        char *end = NULL;
+        char *digest = NULL;
+        char *text = NULL;
+        char *expected = NULL;
+        long long len = 0;
+        size_t header_len = 0;
+        xmlNode *patchset = NULL;
+
+        if ((limit >= 0) && (*processed >= limit)) {
+            rc = -ENODATA;
+            break;
+        }
+
+        errno = 0;
+        len = strtoll(pos, &end, 10);
+        header_len = (end - pos) + CIB_JOURNAL_DIGEST_LEN + 2;
+        if ((errno != 0) || (end == pos) || (*end != ' ') || (len <= 0)
+            || (header_len + len + 1 > remaining)
+            || (pos[header_len - 1] != '\n') || (pos[header_len + len] != '\n')) {
+            // Most likely the last append was interrupted
+            crm_warn("Ignoring incomplete record %d and anything after it in %s",
+                     *processed + 1, path);
+            rc = -ENODATA;
+            break;
+        }
+
+        digest = end + 1;
+        digest[CIB_JOURNAL_DIGEST_LEN] = '\0';
+        text = pos + header_len;
+        text[len] = '\0';
+        remaining -= header_len + len + 1;
+        pos = text + len + 1;
+
+        expected = crm_md5sum(text);
+        if (safe_str_neq(expected, digest)) {
+            crm_warn("Ignoring corrupt record %d and anything after it in %s",
+                     *processed + 1, path);
+            free(expected);
+            rc = -ENODATA;
+            break;
+        }
+        free(expected);
+
+        patchset = string2xml(text);
+        if (patchset == NULL) {
+            crm_warn("Ignoring unparseable record %d and anything after it in %s",
+                     *processed + 1, path);
+            rc = -ENODATA;
+            break;
+        }
+
+        crm_element_value_int(xml, XML_ATTR_GENERATION_ADMIN, &current[0]);
+        crm_element_value_int(xml, XML_ATTR_GENERATION, &current[1]);
+        xml_patch_versions(patchset, add, del);
+
+        if (journal_version_newer(add, current) == FALSE) {
+            crm_trace("Skipping record %d from %s already in the CIB",
+                      *processed + 1, path);
+
+        } else if ((del[0] != current[0]) || (del[1] != current[1])) {
+            crm_warn("Ignoring record %d and anything after it in %s: "
+                     "it follows configuration %d.%d but the CIB is at %d.%d",
+                     *processed + 1, path, del[0], del[1],
+                     current[0], current[1]);
+            rc = -ENODATA;
+
+        } else {
+            rc = xml_apply_patchset(xml, patchset, FALSE);
+            if (rc == pcmk_ok) {
+                crm_xml_add_int(xml, XML_ATTR_GENERATION_ADMIN, add[0]);
+                crm_xml_add_int(xml, XML_ATTR_GENERATION, add[1]);
+                crm_xml_add_int(xml, XML_ATTR_NUMUPDATES, add[2]);
+                (*applied)++;
+            } else {
+                crm_err("Could not apply record %d from %s: %s",
+                        *processed + 1, path, pcmk_strerror(rc));
+            }
+        }
+        free_xml(patchset);
+        if (rc == pcmk_ok) {
+            (*processed)++;
+        }
+    }
+
+    free(contents);
+    return rc;
+}
+
+/*!
+ * \internal
+ * \brief Apply the records in the CIB journals to a CIB
+ *
+ * \param[in]     dir      Directory containing the journals
+ * \param[in,out] xml      CIB to apply records to
+ * \param[in]     limit    Stop after this many records (-1 for no limit)
+ * \param[out]    good     Number of records processed without error
+ * \param[out]    applied  Number of records applied
+ *
+ * \return pcmk_ok if \p xml is usable, otherwise an error code
+ */
+static int
+journal_apply(const char *dir, xmlNode *xml, int limit, int *good,
+              int *applied)
+{
+    const char *files[] = { CIB_JOURNAL_OLD, CIB_JOURNAL };
+    int rc = pcmk_ok;
+    int lpc = 0;
+
+    *good = 0;
+    *applied = 0;
+    for (lpc = 0; (rc == pcmk_ok) && (lpc < DIMOF(files)); lpc++) {
+        char *path = crm_concat(dir, files[lpc], '/');
+
+        rc = journal_apply_file(path, xml, good, limit, applied);
+        free(path);
+    }
+    return (rc == -ENODATA)? pcmk_ok : rc;
+}
+
+/*!
+ * \internal
+ * \brief Bring a CIB read from disk up to date with the CIB journals
+ *
+ * \param[in]     dir   Directory containing the journals
+ * \param[in,out] root  CIB read from disk (may be replaced)
+ *
+ * \return Up-to-date CIB
+ */
+static xmlNode *
+cib_journal_replay(const char *dir, xmlNode *root)
+{
+    int good = 0;
+    int applied = 0;
+    xmlNode *replayed = NULL;
+    char *path = crm_concat(dir, CIB_JOURNAL, '/');
+    char *old_path = crm_concat(dir, CIB_JOURNAL_OLD, '/');
+    gboolean found = (access(path, F_OK) == 0) || (access(old_path, F_OK) == 0);
+
+    free(path);
+    free(old_path);
+    if (found == FALSE) {
+        return root;
+    }
+
+    /* A record that fails to apply may have been partly applied, so work on a
+     * copy, and fall back to replaying only the records before it if
+     * necessary (again on a copy, so the CIB read from disk is used as-is if
+     * even that fails).
+     */
+    replayed = copy_xml(root);
+    if (journal_apply(dir, replayed, -1, &good, &applied) != pcmk_ok) {
+        free_xml(replayed);
+        crm_warn("Using only the first %d records of the CIB journal", good);
+
+        replayed = copy_xml(root);
+        if (journal_apply(dir, replayed, good, &good, &applied) != pcmk_ok) {
+            crm_err("Could not replay CIB journal, ignoring it");
+            free_xml(replayed);
+            replayed = NULL;
+            applied = 0;
+        }
+    }
+
+    if (replayed != NULL) {
+        free_xml(root);
+        root = replayed;
+    }
+
+    crm_notice("Applied %d journaled configuration change%s (epoch is now %s)",
+               applied, ((applied == 1)? "" : "s"),
+               crm_element_value(root, XML_ATTR_GENERATION));
+    return root;
+}
+
 xmlNode *
 readCibXmlFile(const char *dir, const char *file, gboolean discard_status)
 {
@@ -243,6 +776,8 @@ readCibXmlFile(const char *dir, const char *file, gboolean discard_status)
         crm_warn("Continuing with an empty configuration.");
     }
 
+    root = cib_journal_replay(dir, root);
+
     if (cib_writes_enabled && use_valgrind &&
         (crm_is_true(use_valgrind) || strstr(use_valgrind, "pacemaker-based"))) {
 
@@ -325,6 +860,11 @@ uninitializeCib(void)
         return FALSE;
     }
 
+    if ((journal_records > 0) && cib_writes_enabled && (cib_status == pcmk_ok)) {
+        crm_info("Writing CIB to fold in %d journaled changes", journal_records);
+        write_cib_contents(tmp_cib);
+    }
+
     the_cib = NULL;
 
     crm_debug("Deallocating the CIB.");
@@ -380,6 +920,9 @@ cib_diskwrite_complete(mainloop_child_t * p, pid_t pid, int core, int signo, int
     if (exitcode != 0 && cib_writes_enabled) {
         crm_err("Disabling disk writes after write failure");
         cib_writes_enabled = FALSE;
+
+    } else if ((signo == 0) && (exitcode == 0)) {
+        cib_journal_written();
     }
 
     mainloop_trigger_complete(cib_writer);
@@ -391,6 +934,9 @@ write_cib_contents(gpointer p)
     int exit_rc = pcmk_ok;
     xmlNode *cib_local = NULL;
 
+    /* Changes journaled from here on are not covered by this write */
+    cib_journal_rotate();
+
     /* Make a copy of the CIB to write (possibly in a forked child) */
     if (p) {
         /* Synchronous write out */
@@ -426,20 +972,30 @@ write_cib_contents(gpointer p)
             return -1;          /* -1 means 'still work to do' */
         }
 
-        /* Asynchronous write-out after a fork() */
-
-        /* In theory, we can scribble on the_cib here and not affect the parent,
-         * but let's be safe anyway.
+        /* Asynchronous write-out after a fork()
+         *
+         * The child's memory is a copy-on-write snapshot of the parent's, so
+         * the_cib can be written (and scribbled on) here without copying it
+         * and without affecting the parent.
          */
-        cib_local = copy_xml(the_cib);
+        cib_local = the_cib;
+        the_cib = NULL;
     }
 
     /* Write the CIB */
     exit_rc = cib_file_write_with_digest(cib_local, cib_root, "cib.xml");
 
     /* A nonzero exit code will cause further writes to be disabled */
-    free_xml(cib_local);
-    if (p == NULL) {
+    if (p != NULL) {
+        free_xml(cib_local);
+        if (exit_rc == pcmk_ok) {
+            cib_journal_written();
+        }
+
+    } else {
+        /* Don't free the snapshot: that would touch (and so copy) every page
+         * of it, just before _exit() releases it anyway
+         */
         crm_exit_t exit_code = CRM_EX_OK;
 
         switch (exit_rc) {
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
@@ -132,8 +133,132 @@ cib_process_readwrite(const char *op, int options, const char *section, xmlNode
  */
 static int sync_in_progress = 0;
 
+/* Recent patchsets (oldest first), so that a peer that has missed only a few
+ * updates can be sent those rather than the whole CIB
+ */
+#define CIB_HISTORY_MAX 100
+#define CIB_TAG_PATCHSETS "cib_patchsets"
+
+static GQueue *cib_history = NULL;
+
+/*!
+ * \internal
+ * \brief Remember a patchset that was applied to our CIB
+ *
+ * \param[in] patchset  Patchset describing the latest change (will be copied)
+ */
 void
-send_sync_request(const char *host)
+cib_history_add(xmlNode *patchset)
+{
+    int format = 1;
+
+    if (patchset == NULL) {
+        return;
+    }
+
+    /* Anything else leaves a gap in the versions, which stops a peer from
+     * being sent patchsets across it
+     */
+    crm_element_value_int(patchset, "format", &format);
+    if (format != 2) {
+        return;
+    }
+
+    if (cib_history == NULL) {
+        cib_history = g_queue_new();
+    }
+    g_queue_push_tail(cib_history, copy_xml(patchset));
+    while (g_queue_get_length(cib_history) > CIB_HISTORY_MAX) {
+        free_xml(g_queue_pop_head(cib_history));
+    }
+}
+
+/*!
+ * \internal
+ * \brief Get the recent patchsets that bring a peer's CIB up to date with ours
+ *
+ * \param[in]  version  Version of the peer's CIB (as "admin.epoch.updates")
+ * \param[out] count    Where to store the number of patchsets
+ *
+ * \return Newly created element containing copies of the patchsets, in order,
+ *         or NULL if our history doesn't cover the versions in between
+ */
+static xmlNode *
+cib_history_since(const char *version, int *count)
+{
+    int since[] = { 0, 0, 0 };
+    int current[] = { 0, 0, 0 };
+    GList *iter = NULL;
+    xmlNode *patchsets = NULL;
+
+    *count = 0;
+    if ((version == NULL) || (cib_history == NULL)
+        || (sscanf(version, "%d.%d.%d", &since[0], &since[1], &since[2]) != 3)) {
+        return NULL;
+    }
+    cib_version_details(the_cib, &current[0], &current[1], &current[2]);
+
+    for (iter = cib_history->head; iter != NULL; iter = iter->next) {
+        int add[] = { 0, 0, 0 };
+        int del[] = { 0, 0, 0 };
+
+        xml_patch_versions(iter->data, add, del);
+        if (memcmp(del, since, sizeof(since)) != 0) {
+            if (patchsets == NULL) {
+                continue; // Not reached the peer's version yet
+            }
+            crm_trace("Gap in CIB history before %d.%d.%d",
+                      del[0], del[1], del[2]);
+            free_xml(patchsets);
+            return NULL;
+        }
+
+        if (patchsets == NULL) {
+            patchsets = create_xml_node(NULL, CIB_TAG_PATCHSETS);
+        }
+        add_node_copy(patchsets, iter->data);
+        memcpy(since, add, sizeof(since));
+        (*count)++;
+    }
+
+    if ((patchsets != NULL) && (memcmp(since, current, sizeof(since)) != 0)) {
+        free_xml(patchsets);
+        patchsets = NULL;
+    }
+    if (patchsets == NULL) {
+        *count = 0;
+    }
+    return patchsets;
+}
+
+/*!
+ * \internal
+ * \brief Add our CIB version to a sync request
+ *
+ * This lets the peer that answers send just the changes we are missing, if it
+ * still has them.
+ *
+ * \param[in,out] request  Sync request to add version to
+ */
+void
+cib_sync_add_version(xmlNode *request)
+{
+    int admin_epoch = 0;
+    int epoch = 0;
+    int updates = 0;
+    char *version = NULL;
+
+    if (the_cib == NULL) {
+        return;
+    }
+    cib_version_details(the_cib, &admin_epoch, &epoch, &updates);
+    version = crm_strdup_printf("%d.%d.%d", admin_epoch, epoch, updates);
+    crm_xml_add(request, F_CIB_SYNC_VERSION, version);
+    free(version);
+}
+
+static void
+request_sync(const char *host, gboolean whole)
 {
     xmlNode *sync_me = create_xml_node(NULL, "sync-me");
 
@@ -143,11 +268,77 @@ send_sync_request(const char *host)
     crm_xml_add(sync_me, F_TYPE, "cib");
     crm_xml_add(sync_me, F_CIB_OPERATION, CIB_OP_SYNC_ONE);
     crm_xml_add(sync_me, F_CIB_DELEGATED, cib_our_uname);
+    if (whole == FALSE) {
+        cib_sync_add_version(sync_me);
+    }
 
     send_cluster_message(host ? crm_get_peer(0, host) : NULL, crm_msg_cib, sync_me, FALSE);
     free_xml(sync_me);
 }
 
+void
+send_sync_request(const char *host)
+{
+    request_sync(host, FALSE);
+}
+
+/*!
+ * \internal
+ * \brief Apply the recent patchsets sent by a peer in answer to a sync request
+ *
+ * \param[in]     req         Replace request from the peer
+ * \param[in]     patchsets   Patchsets from the request
+ * \param[in,out] result_cib  CIB to apply patchsets to
+ *
+ * \return Standard Pacemaker return code
+ */
+static int
+cib_process_patchsets(xmlNode *req, xmlNode *patchsets, xmlNode **result_cib)
+{
+    int rc = pcmk_ok;
+    int count = 0;
+    xmlNode *patchset = NULL;
+    const char *peer = crm_element_value(req, F_ORIG);
+    const char *digest = crm_element_value(req, XML_ATTR_DIGEST);
+
+    for (patchset = __xml_first_child_element(patchsets);
+         (patchset != NULL) && (rc == pcmk_ok);
+         patchset = __xml_next_element(patchset)) {
+
+        rc = xml_apply_patchset(*result_cib, patchset, TRUE);
+        count++;
+    }
+
+    /* The digest is of the peer's whole CIB, so this also catches a CIB that
+     * has the version the peer expected but different contents
+     */
+    if ((rc == pcmk_ok) && (digest != NULL)) {
+        const char *version = crm_element_value(req, XML_ATTR_CRM_VERSION);
+        char *digest_verify = calculate_xml_versioned_digest(*result_cib, FALSE,
+                                                             TRUE,
+                                                             version ? version :
+                                                             CRM_FEATURE_SET);
+
+        if (safe_str_neq(digest_verify, digest)) {
+            crm_err("Digest mis-match after applying changes from %s: %s vs. %s (expected)",
+                    peer, digest_verify, digest);
+            rc = -pcmk_err_diff_failed;
+        }
+        free(digest_verify);
+    }
+
+    if (rc != pcmk_ok) {
+        crm_notice("Could not apply recent changes from %s (%s), requesting whole CIB",
+                   peer, pcmk_strerror(rc));
+        request_sync(peer, TRUE);
+
+    } else {
+        crm_info("Applied %d recent change%s from %s",
+                 count, ((count == 1)? "" : "s"), peer);
+    }
+    return rc;
+}
+
 int
 cib_process_ping(const char *op, int options, const char *section, xmlNode * req, xmlNode * input,
                  xmlNode * existing_cib, xmlNode ** result_cib, xmlNode ** answer)
@@ -335,9 +526,17 @@ cib_process_replace_svr(const char *op, int options, const char *section, xmlNod
                         xmlNode ** answer)
 {
     const char *tag = crm_element_name(input);
-    int rc =
-        cib_process_replace(op, options, section, req, input, existing_cib, result_cib, answer);
-    if (rc == pcmk_ok && safe_str_eq(tag, XML_TAG_CIB)) {
+    int rc = pcmk_ok;
+
+    if (safe_str_eq(tag, CIB_TAG_PATCHSETS)) {
+        *answer = NULL;
+        rc = cib_process_patchsets(req, input, result_cib);
+    } else {
+        rc = cib_process_replace(op, options, section, req, input, existing_cib,
+                                 result_cib, answer);
+    }
+    if (rc == pcmk_ok
+        && (safe_str_eq(tag, XML_TAG_CIB) || safe_str_eq(tag, CIB_TAG_PATCHSETS))) {
         sync_in_progress = 0;
     }
     return rc;
@@ -452,10 +651,12 @@ int
 sync_our_cib(xmlNode * request, gboolean all)
 {
     int result = pcmk_ok;
+    int count = 0;
     char *digest = NULL;
     const char *host = crm_element_value(request, F_ORIG);
     const char *op = crm_element_value(request, F_CIB_OPERATION);
 
+    xmlNode *patchsets = NULL;
     xmlNode *replace_request = cib_msg_copy(request, FALSE);
 
     CRM_CHECK(the_cib != NULL,;);
@@ -488,7 +689,21 @@ sync_our_cib(xmlNode * request, gboolean all)
     digest = calculate_xml_versioned_digest(the_cib, FALSE, TRUE, CRM_FEATURE_SET);
     crm_xml_add(replace_request, XML_ATTR_DIGEST, digest);
 
-    add_message_xml(replace_request, F_CIB_CALLDATA, the_cib);
+    /* A peer that told us its version can be sent just what it is missing */
+    if (all == FALSE) {
+        patchsets = cib_history_since(crm_element_value(request,
+                                                        F_CIB_SYNC_VERSION),
+                                      &count);
+    }
+    if (patchsets != NULL) {
+        crm_info("Sending %s the %d change%s it is missing rather than the whole CIB",
+                 host, count, ((count == 1)? "" : "s"));
+        add_message_xml(replace_request, F_CIB_CALLDATA, patchsets);
+        free_xml(patchsets);
+
+    } else {
+        add_message_xml(replace_request, F_CIB_CALLDATA, the_cib);
+    }
 
     if (send_cluster_message
         (all ? NULL : crm_get_peer(0, host), crm_msg_cib, replace_request, FALSE) == FALSE) {
@@ -17,6 +17,7 @@
 #include <fcntl.h>
 
 #include <time.h>
+#include <string.h>
 
 #include <crm/crm.h>
 #include <crm/cib/internal.h>
@@ -27,10 +28,26 @@
 
 int pending_updates = 0;
 
+/* Status updates after which the CIB size used for merging is remeasured */
+#define CIB_SIZE_REFRESH_UPDATES 100
+
+/* Diff notification filters that subscribers have registered, by client ID */
+static GHashTable *notify_filters = NULL;
+
 struct cib_notification_s {
     xmlNode *msg;
-    struct iovec *iov;
-    int32_t iov_size;
+    pcmk__shared_msg_t *shared; /* msg, serialized once for all clients */
+    bool filterable;            /* Whether msg is a v2 diff that can be pruned */
+    GHashTable *variants;       /* Filter -> struct cib_notify_variant_s */
+};
+
+/* A diff notification as seen through one filter, shared by every client
+ * that registered that filter
+ */
+struct cib_notify_variant_s {
+    xmlNode *msg;               /* NULL if no change passes the filter */
+    pcmk__shared_msg_t *shared;
+    bool pruned;                /* Whether msg is our own pruned copy */
 };
 
 void attach_cib_generation(xmlNode * msg, const char *field, xmlNode * a_cib);
@@ -38,11 +55,406 @@ void attach_cib_generation(xmlNode * msg, const char *field, xmlNode * a_cib);
 void do_cib_notify(int options, const char *op, xmlNode * update,
                    int result, xmlNode * result_data, const char *msg_type);
 
+/*!
+ * \internal
+ * \brief Create a notification telling a client to re-read the whole CIB
+ *
+ * \param[in] msg  Latest diff notification the client would have been sent
+ */
+static xmlNode *
+cib_notify_resync_marker(xmlNode *msg)
+{
+    xmlNode *marker = create_xml_node(NULL, "notify");
+
+    crm_xml_add(marker, F_TYPE, T_CIB_NOTIFY);
+    crm_xml_add(marker, F_SUBTYPE, T_CIB_DIFF_NOTIFY);
+    crm_xml_add(marker, F_CIB_OPERATION, crm_element_value(msg, F_CIB_OPERATION));
+    crm_xml_add_int(marker, F_CIB_RC, -pcmk_err_diff_resync);
+    attach_cib_generation(marker, "cib_generation", the_cib);
+    return marker;
+}
+
+/*!
+ * \internal
+ * \brief Get the (approximate) serialized size of the CIB
+ *
+ * Serializing the whole CIB is too costly to do for every merge, so the size
+ * is remeasured only when the configuration changes, or after
+ * CIB_SIZE_REFRESH_UPDATES status updates.
+ *
+ * \return Size of the CIB when last measured
+ */
+static size_t
+cib_notify_cib_size(void)
+{
+    static size_t size = 0;
+    static int measured[] = { -1, -1, -1 };
+    int current[] = { 0, 0, 0 };
+
+    crm_element_value_int(the_cib, XML_ATTR_GENERATION_ADMIN, &current[0]);
+    crm_element_value_int(the_cib, XML_ATTR_GENERATION, &current[1]);
+    crm_element_value_int(the_cib, XML_ATTR_NUMUPDATES, &current[2]);
+
+    if ((current[0] != measured[0]) || (current[1] != measured[1])
+        || (current[2] < measured[2])
+        || (current[2] - measured[2] >= CIB_SIZE_REFRESH_UPDATES)) {
+
+        size = crm_xml_dump_len(the_cib, 0, 0);
+        memcpy(measured, current, sizeof(measured));
+        crm_trace("CIB is %llu bytes at %d.%d.%d", (unsigned long long) size,
+                  current[0], current[1], current[2]);
+    }
+    return size;
+}
+
+/*!
+ * \internal
+ * \brief Merge a diff notification into one still queued for a client
+ *
+ * \param[in] queued  Notification waiting to be sent
+ * \param[in] msg     Newer notification
+ *
+ * \return Newly allocated notification with the changes of both (or a resync
+ *         marker, once that would be bigger than the CIB itself), or NULL if
+ *         the two can't be merged
+ */
+static xmlNode *
+cib_notify_merge_diffs(xmlNode *queued, xmlNode *msg)
+{
+    int rc = pcmk_ok;
+    int format = 1;
+    xmlNode *merged = NULL;
+    xmlNode *old_diff = NULL;
+    xmlNode *new_diff = NULL;
+    xmlNode *version = NULL;
+    xmlNode *source = NULL;
+    xmlNode *first_change = NULL;
+    xmlNode *change = NULL;
+
+    if (safe_str_neq(crm_element_value(queued, F_SUBTYPE), T_CIB_DIFF_NOTIFY)
+        || safe_str_neq(crm_element_value(msg, F_SUBTYPE), T_CIB_DIFF_NOTIFY)) {
+        return NULL;
+    }
+
+    crm_element_value_int(queued, F_CIB_RC, &rc);
+    if (rc == -pcmk_err_diff_resync) {
+        /* The client will re-read the CIB, which will include these changes */
+        return cib_notify_resync_marker(msg);
+    }
+
+    old_diff = get_message_xml(queued, F_CIB_UPDATE_RESULT);
+    crm_element_value_int(old_diff, "format", &format);
+    if (rc != pcmk_ok || format != 2) {
+        return cib_notify_resync_marker(msg);
+    }
+
+    crm_element_value_int(msg, F_CIB_RC, &rc);
+    new_diff = get_message_xml(msg, F_CIB_UPDATE_RESULT);
+    format = 1;
+    crm_element_value_int(new_diff, "format", &format);
+    if (rc != pcmk_ok || format != 2) {
+        return cib_notify_resync_marker(msg);
+    }
+
+    /* v2 changes are applied in order, so the merged patchset is the new one,
+     * starting from the old one's source version, with the old one's changes
+     * in front of its own
+     */
+    merged = copy_xml(msg);
+    new_diff = get_message_xml(merged, F_CIB_UPDATE_RESULT);
+
+    /* Keep the new target version, but start from the old source version */
+    version = find_xml_node(new_diff, XML_DIFF_VERSION, FALSE);
+    source = find_xml_node(find_xml_node(old_diff, XML_DIFF_VERSION, FALSE),
+                           XML_DIFF_VSOURCE, FALSE);
+    if ((version == NULL) || (source == NULL)) {
+        free_xml(merged);
+        return cib_notify_resync_marker(msg);
+    }
+    free_xml(find_xml_node(version, XML_DIFF_VSOURCE, FALSE));
+    source = xmlDocCopyNode(source, new_diff->doc, 1);
+    if (version->children) {
+        xmlAddPrevSibling(version->children, source);
+    } else {
+        xmlAddChild(version, source);
+    }
+
+    /* The version comes first in a patchset, followed by the changes */
+    first_change = __xml_next(version);
+
+    for (change = __xml_first_child(old_diff); change != NULL;
+         change = __xml_next(change)) {
+
+        if (safe_str_neq(crm_element_name(change), XML_DIFF_VERSION)) {
+            xmlNode *copy = xmlDocCopyNode(change, new_diff->doc, 1);
+
+            if (first_change) {
+                xmlAddPrevSibling(first_change, copy);
+            } else {
+                xmlAddChild(new_diff, copy);
+            }
+        }
+    }
+
+    if (crm_xml_dump_len(merged, 0, 0) > cib_notify_cib_size()) {
+        crm_debug("Merged notification is bigger than the CIB, sending a resync marker instead");
+        free_xml(merged);
+        return cib_notify_resync_marker(msg);
+    }
+    return merged;
+}
+
+/*!
+ * \internal
+ * \brief Convert a subscriber's diff notification filter to canonical form
+ *
+ * \param[in] filter  Space-separated list of CIB section names (as accepted by
+ *                    get_object_path()) and/or absolute paths
+ *
+ * \return Newly allocated space-separated list of absolute paths, or NULL if
+ *         \p filter has none
+ */
+static char *
+cib_notify_normalize_filter(const char *filter)
+{
+    char *normalized = NULL;
+    char *copy = NULL;
+    char *entry = NULL;
+    char *saveptr = NULL;
+
+    if (filter == NULL) {
+        return NULL;
+    }
+
+    copy = strdup(filter);
+    for (entry = strtok_r(copy, " \t\n", &saveptr); entry != NULL;
+         entry = strtok_r(NULL, " \t\n", &saveptr)) {
+
+        const char *path = entry;
+
+        if (*path != '/') {
+            path = get_object_path(entry);
+            if (path == NULL) {
+                crm_warn("Ignoring unknown CIB section '%s' in notification filter",
+                         entry);
+                continue;
+            }
+            path++; /* Change paths start with a single slash */
+        }
+        normalized = add_list_element(normalized, path);
+    }
+    free(copy);
+    return normalized;
+}
+
+/*!
+ * \internal
+ * \brief Set or clear the diff notification filter of a subscriber
+ *
+ * \param[in] client  Client that registered for diff notifications
+ * \param[in] filter  Space-separated list of CIB section names and/or absolute
+ *                    paths that the client cares about (or NULL for all)
+ */
+void
+cib_notify_set_filter(crm_client_t *client, const char *filter)
+{
+    char *normalized = cib_notify_normalize_filter(filter);
+
+    if (normalized == NULL) {
+        if (notify_filters) {
+            g_hash_table_remove(notify_filters, client->id);
+        }
+        return;
+    }
+
+    if (notify_filters == NULL) {
+        notify_filters = crm_str_table_new();
+    }
+    crm_debug("Filtering diff notifications for %s (%s) to:%s",
+              client->name, client->id, normalized);
+    g_hash_table_replace(notify_filters, strdup(client->id), normalized);
+}
+
+/*!
+ * \internal
+ * \brief Forget any notification filter of a client that is going away
+ *
+ * \param[in] client  Client being destroyed
+ */
+void
+cib_notify_forget_client(crm_client_t *client)
+{
+    if (notify_filters && client->id) {
+        g_hash_table_remove(notify_filters, client->id);
+    }
+}
+
+/*!
+ * \internal
+ * \brief Check whether a path is, or is beneath, another
+ *
+ * \param[in] path          Path to check
+ * \param[in] path_len      Length of \p path
+ * \param[in] ancestor      Possible ancestor path
+ * \param[in] ancestor_len  Length of \p ancestor
+ *
+ * \return TRUE if \p path is \p ancestor or a descendant of it (an ancestor
+ *         step without an ID predicate matches any ID)
+ */
+static bool
+cib_notify_path_within(const char *path, size_t path_len,
+                       const char *ancestor, size_t ancestor_len)
+{
+    return (path_len >= ancestor_len)
+           && (strncmp(path, ancestor, ancestor_len) == 0)
+           && ((path_len == ancestor_len)
+               || (path[ancestor_len] == '/') || (path[ancestor_len] == '['));
+}
+
+/*!
+ * \internal
+ * \brief Check whether a v2 patchset change is of interest to a filter
+ *
+ * \param[in] change  Change element of a v2 patchset
+ * \param[in] filter  Normalized filter (see cib_notify_normalize_filter())
+ *
+ * \return TRUE if \p change touches anything within a path in \p filter
+ */
+static bool
+cib_notify_change_passes(xmlNode *change, const char *filter)
+{
+    const char *op = crm_element_value(change, XML_DIFF_OP);
+    const char *path = crm_element_value(change, XML_DIFF_PATH);
+    size_t path_len = 0;
+
+    /* Creations name the new element's parent, and deletions take everything
+     * below, so both can affect a filtered path beneath them. Modifications
+     * and moves only affect the element itself.
+     */
+    bool affects_below = safe_str_eq(op, "create") || safe_str_eq(op, "delete");
+
+    if (path == NULL) {
+        return TRUE;
+    }
+    path_len = strlen(path);
+
+    while (*filter != '\0') {
+        size_t len = 0;
+
+        filter += strspn(filter, " ");
+        len = strcspn(filter, " ");
+        if (len > 0) {
+            if (cib_notify_path_within(path, path_len, filter, len)
+                || (affects_below
+                    && cib_notify_path_within(filter, len, path, path_len))) {
+                return TRUE;
+            }
+        }
+        filter += len;
+    }
+    return FALSE;
+}
+
+static void
+cib_notify_free_variant(gpointer data)
+{
+    struct cib_notify_variant_s *variant = data;
+
+    if (variant->pruned) {
+        free_xml(variant->msg);
+        pcmk__shared_msg_unref(variant->shared);
+    }
+    free(variant);
+}
+
+/*!
+ * \internal
+ * \brief Get a diff notification as seen through a subscriber's filter
+ *
+ * Each distinct filter is applied (and its result serialized) only once per
+ * notification, no matter how many clients registered it.
+ *
+ * \param[in,out] update  Notification being sent
+ * \param[in]     filter  Normalized filter
+ *
+ * \return Notification variant for \p filter
+ */
+static struct cib_notify_variant_s *
+cib_notify_variant(struct cib_notification_s *update, const char *filter)
+{
+    struct cib_notify_variant_s *variant = NULL;
+    xmlNode *diff = NULL;
+    xmlNode *change = NULL;
+    int kept = 0;
+    int dropped = 0;
+
+    if (update->variants == NULL) {
+        update->variants = g_hash_table_new_full(crm_str_hash, g_str_equal,
+                                                 free, cib_notify_free_variant);
+    } else {
+        variant = g_hash_table_lookup(update->variants, filter);
+        if (variant) {
+            return variant;
+        }
+    }
+
+    variant = calloc(1, sizeof(struct cib_notify_variant_s));
+    CRM_ASSERT(variant != NULL);
+    g_hash_table_insert(update->variants, strdup(filter), variant);
+
+    diff = get_message_xml(update->msg, F_CIB_UPDATE_RESULT);
+    for (change = __xml_first_child(diff); change != NULL;
+         change = __xml_next(change)) {
+
+        if (safe_str_eq(crm_element_name(change), XML_DIFF_VERSION)) {
+            continue;
+        } else if (cib_notify_change_passes(change, filter)) {
+            kept++;
+        } else {
+            dropped++;
+        }
+    }
+
+    if (kept == 0) {
+        crm_trace("Suppressing diff notification for filter%s", filter);
+
+    } else if (dropped == 0) {
+        variant->msg = update->msg;
+        variant->shared = update->shared;
+
+    } else {
+        xmlNode *next = NULL;
+
+        crm_trace("Pruning %d of %d changes for filter%s",
+                  dropped, kept + dropped, filter);
+        variant->msg = copy_xml(update->msg);
+        variant->pruned = TRUE;
+
+        /* The digest covers the whole result, which pruned clients can't
+         * reconstruct
+         */
+        diff = get_message_xml(variant->msg, F_CIB_UPDATE_RESULT);
+        xml_remove_prop(diff, XML_ATTR_DIGEST);
+
+        for (change = __xml_first_child(diff); change != NULL; change = next) {
+            next = __xml_next(change);
+            if (safe_str_neq(crm_element_name(change), XML_DIFF_VERSION)
+                && !cib_notify_change_passes(change, filter)) {
+                free_xml(change);
+            }
+        }
+        variant->shared = pcmk__shared_msg_new(variant->msg);
+    }
+    return variant;
+}
+
 static gboolean
 cib_notify_send_one(gpointer key, gpointer value, gpointer user_data)
 {
     const char *type = NULL;
     gboolean do_send = FALSE;
+    xmlNode *msg = NULL;
+    pcmk__shared_msg_t *shared = NULL;
 
     crm_client_t *client = value;
     struct cib_notification_s *update = user_data;
@@ -76,20 +488,55 @@ cib_notify_send_one(gpointer key, gpointer value, gpointer user_data)
         do_send = TRUE;
     }
 
+    msg = update->msg;
+    shared = update->shared;
+    if (do_send && update->filterable && notify_filters) {
+        const char *filter = g_hash_table_lookup(notify_filters, client->id);
+
+        if (filter) {
+            struct cib_notify_variant_s *variant = cib_notify_variant(update,
+                                                                      filter);
+
+            msg = variant->msg;
+            shared = variant->shared;
+            do_send = (msg != NULL);
+        }
+    }
+
     if (do_send) {
         switch (client->kind) {
             case CRM_CLIENT_IPC:
-                if (crm_ipcs_sendv(client, update->iov, crm_ipc_server_event) < 0) {
+            {
+                ssize_t rc = 0;
+
+                if (is_set(client->options, cib_notify_merge)
+                    && (client->mergeable_event
+                        || (client->event_queue
+                            && !g_queue_is_empty(client->event_queue)))) {
+                    /* The client is falling behind */
+                    rc = pcmk__ipcs_send_mergeable(client, msg,
+                                                   cib_notify_merge_diffs);
+                } else {
+                    rc = pcmk__ipcs_send_shared(client, shared,
+                                                crm_ipc_server_event);
+                }
+                if (rc < 0) {
                     crm_warn("Notification of client %s/%s failed", client->name, client->id);
                 }
                 break;
+            }
 #ifdef HAVE_GNUTLS_GNUTLS_H
             case CRM_CLIENT_TLS:
 #endif
             case CRM_CLIENT_TCP:
+            {
+                size_t len = 0;
+                const char *text = pcmk__shared_msg_text(shared, &len);
+
                 crm_debug("Sent %s notification to client %s/%s", type, client->name, client->id);
-                crm_remote_send(client->remote, update->msg);
+                crm_remote_send_text(client->remote, text, len);
                 break;
+            }
             default:
                 crm_err("Unknown transport %d for %s", client->kind, client->name);
         }
@@ -100,23 +547,32 @@ cib_notify_send_one(gpointer key, gpointer value, gpointer user_data)
 static void
 cib_notify_send(xmlNode * xml)
 {
-    struct iovec *iov;
-    struct cib_notification_s update;
-
-    ssize_t rc = crm_ipc_prepare(0, xml, &iov, 0);
+    struct cib_notification_s update = { NULL, };
 
     crm_trace("Notifying clients");
-    if (rc > 0) {
-        update.msg = xml;
-        update.iov = iov;
-        update.iov_size = rc;
-        g_hash_table_foreach_remove(client_connections, cib_notify_send_one, &update);
+    update.msg = xml;
+    update.shared = pcmk__shared_msg_new(xml);
+
+    /* Only successful v2 diffs can be pruned per subscriber; anything else
+     * goes to every subscriber as-is
+     */
+    if (safe_str_eq(crm_element_value(xml, F_SUBTYPE), T_CIB_DIFF_NOTIFY)) {
+        int rc = pcmk_ok;
+        int format = 1;
+        xmlNode *diff = get_message_xml(xml, F_CIB_UPDATE_RESULT);
+
+        crm_element_value_int(xml, F_CIB_RC, &rc);
+        if (diff) {
+            crm_element_value_int(diff, "format", &format);
+        }
+        update.filterable = (rc == pcmk_ok) && (format == 2);
+    }
 
-    } else {
-        crm_notice("Could not notify clients: %s " CRM_XS " rc=%lld",
-                   pcmk_strerror(rc), (long long) rc);
+    g_hash_table_foreach_remove(client_connections, cib_notify_send_one, &update);
+    if (update.variants) {
+        g_hash_table_destroy(update.variants);
     }
-    pcmk_free_ipc_event(iov);
+    pcmk__shared_msg_unref(update.shared);
     crm_trace("Notify complete");
 }
 
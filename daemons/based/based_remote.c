@@ -385,6 +385,7 @@ cib_remote_connection_destroy(gpointer user_data)
         close(csock);
     }
 
+    cib_notify_forget_client(client);
     crm_client_destroy(client);
 
     crm_trace("Freed the cib client");
@@ -525,6 +526,8 @@ cib_remote_msg(gpointer data)
         reg = create_xml_node(NULL, "cib_result");
         crm_xml_add(reg, F_CIB_OPERATION, CRM_OP_REGISTER);
         crm_xml_add(reg, F_CIB_CLIENTID, client->id);
+        crm_remote_set_codecs(client->remote, command);
+        crm_remote_add_codecs(reg);
         crm_remote_send(client->remote, reg);
         free_xml(reg);
         free_xml(command);
@@ -35,6 +35,7 @@ enum cib_notifications {
     cib_notify_replace = 0x0004,
     cib_notify_confirm = 0x0008,
     cib_notify_diff    = 0x0010,
+    cib_notify_merge   = 0x0020, // Merge diffs queued for a slow client
 
     // Not a notification, but uses the same IPC bitmask
     cib_is_daemon      = 0x1000, // Whether client is another cluster daemon
@@ -90,6 +91,7 @@ xmlNode *readCibXml(char *buffer);
 xmlNode *readCibXmlFile(const char *dir, const char *file,
                         gboolean discard_status);
 int activateCibXml(xmlNode *doc, gboolean to_disk, const char *op);
+gboolean cib_journal_append(xmlNode *patchset, const char *op);
 
 xmlNode *createCibRequest(gboolean isLocal, const char *operation,
                           const char *section, const char *verbose,
@@ -128,6 +130,8 @@ int cib_process_upgrade_server(const char *op, int options, const char *section,
                                xmlNode *existing_cib, xmlNode **result_cib,
                                xmlNode **answer);
 void send_sync_request(const char *host);
+void cib_sync_add_version(xmlNode *request);
+void cib_history_add(xmlNode *patchset);
 
 xmlNode *cib_msg_copy(xmlNode *msg, gboolean with_data);
 xmlNode *cib_construct_reply(xmlNode *request, xmlNode *output, int rc);
@@ -145,6 +149,8 @@ void cib_diff_notify(int options, const char *client, const char *call_id,
                      xmlNode *old_cib);
 void cib_replace_notify(const char *origin, xmlNode *update, int result,
                         xmlNode *diff);
+void cib_notify_set_filter(crm_client_t *client, const char *filter);
+void cib_notify_forget_client(crm_client_t *client);
 
 static inline const char *
 cib_config_lookup(const char *opt)
@@ -369,14 +369,45 @@ lrm_state_is_connected(lrm_state_t * lrm_state)
     return ((lrmd_t *) lrm_state->conn)->cmds->is_connected(lrm_state->conn);
 }
 
+static void
+poke_reply_cb(lrmd_t *lrmd, int rc, xmlNode *reply, void *user_data)
+{
+    char *node_name = user_data;
+
+    /* A successful poke is reported by the poke event, and a missing one by
+     * the monitor's own timeout, so this is only of interest when debugging
+     */
+    if (rc != pcmk_ok) {
+        crm_info("No reply to poke of Pacemaker Remote node %s: %s",
+                 node_name, pcmk_strerror(rc));
+    }
+    free(node_name);
+}
+
 int
 lrm_state_poke_connection(lrm_state_t * lrm_state)
 {
+    int rc = pcmk_ok;
+    xmlNode *data = NULL;
+    char *node_name = NULL;
 
     if (!lrm_state->conn) {
         return -1;
     }
-    return ((lrmd_t *) lrm_state->conn)->cmds->poke_connection(lrm_state->conn);
+
+    /* Don't wait for the reply, so pokes of many remote nodes can be
+     * outstanding at once
+     */
+    data = create_xml_node(NULL, F_LRMD_RSC);
+    crm_xml_add(data, F_LRMD_ORIGIN, __FUNCTION__);
+    node_name = strdup(lrm_state->node_name);
+    rc = lrmd_internal_send_async(lrm_state->conn, LRMD_OP_POKE, data, 0, 0,
+                                  poke_reply_cb, node_name);
+    free_xml(data);
+    if (rc != pcmk_ok) {
+        free(node_name);
+    }
+    return rc;
 }
 
 int
@@ -11,6 +11,7 @@
 
 #include <crm/crm.h>
 #include <crm/common/xml.h>
+#include <crm/common/xml_internal.h>
 #include <crm/msg_xml.h>
 
 #include <controld_transition.h>
@@ -28,7 +29,7 @@ crm_trigger_t *transition_trigger = NULL;
 static unsigned long int stonith_max_attempts = 10;
 
 /* #define rsc_op_template "//"XML_TAG_DIFF_ADDED"//"XML_TAG_CIB"//"XML_CIB_TAG_STATE"[@uname='%s']"//"XML_LRM_TAG_RSC_OP"[@id='%s]" */
-#define rsc_op_template "//"XML_TAG_DIFF_ADDED"//"XML_TAG_CIB"//"XML_LRM_TAG_RSC_OP"[@id='%s']"
+#define rsc_op_template "//"XML_TAG_DIFF_ADDED"//"XML_TAG_CIB"//"XML_LRM_TAG_RSC_OP"[@id=$id]"
 
 static const char *
 get_node_id(xmlNode * rsc_op)
@@ -180,9 +181,7 @@ te_update_diff_v1(const char *event, xmlNode *diff)
     xpathObj = xpath_search(diff, "//" XML_TAG_DIFF_REMOVED "//" XML_LRM_TAG_RSC_OP);
     max = numXpathResults(xpathObj);
     for (lpc = 0; lpc < max; lpc++) {
-        int path_max = 0;
         const char *op_id = NULL;
-        char *rsc_op_xpath = NULL;
         xmlXPathObject *op_match = NULL;
         xmlNode *match = getXpathResult(xpathObj, lpc);
 
@@ -191,22 +190,17 @@ te_update_diff_v1(const char *event, xmlNode *diff)
 
         op_id = ID(match);
 
-        path_max = strlen(rsc_op_template) + strlen(op_id) + 1;
-        rsc_op_xpath = calloc(1, path_max);
-        snprintf(rsc_op_xpath, path_max, rsc_op_template, op_id);
-
-        op_match = xpath_search(diff, rsc_op_xpath);
+        op_match = crm_xpath_search_with(diff, rsc_op_template, "id", op_id, NULL);
         if (numXpathResults(op_match) == 0) {
             /* Prevent false positives by matching cancelations too */
             const char *node = get_node_id(match);
             crm_action_t *cancelled = get_cancel_action(op_id, node);
 
             if (cancelled == NULL) {
-                crm_debug("No match for deleted action %s (%s on %s)", rsc_op_xpath, op_id,
+                crm_debug("No match for deleted action %s (%s on %s)", rsc_op_template, op_id,
                           node);
                 abort_transition(INFINITY, tg_restart, "Resource op removal", match);
                 freeXpathObject(op_match);
-                free(rsc_op_xpath);
                 goto bail;
 
             } else {
@@ -216,7 +210,6 @@ te_update_diff_v1(const char *event, xmlNode *diff)
         }
 
         freeXpathObject(op_match);
-        free(rsc_op_xpath);
     }
 
   bail:
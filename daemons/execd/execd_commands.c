@@ -1288,6 +1288,14 @@ process_lrmd_signon(crm_client_t *client, xmlNode *request, int call_id)
     crm_xml_add(reply, F_LRMD_CLIENTID, client->id);
     crm_xml_add(reply, F_LRMD_PROTOCOL_VERSION, LRMD_PROTOCOL_VERSION);
 
+    if (client->remote) {
+        /* Only compress for clients that can take it, and tell them what
+         * we can take
+         */
+        crm_remote_set_codecs(client->remote, request);
+        crm_remote_add_codecs(reply);
+    }
+
     if (crm_is_true(is_ipc_provider)) {
         // This is a remote connection from a cluster node's controller
 #ifdef SUPPORT_REMOTE
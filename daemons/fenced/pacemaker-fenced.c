@@ -27,6 +27,7 @@
 #include <crm/stonith-ng.h>
 #include <crm/fencing/internal.h>
 #include <crm/common/xml.h>
+#include <crm/common/xml_internal.h>
 
 #include <crm/common/mainloop.h>
 
@@ -848,9 +849,6 @@ update_cib_stonith_devices(const char *event, xmlNode * msg)
     }
 }
 
-/* Needs to hold node name + attribute name + attribute value + 75 */
-#define XPATH_MAX 512
-
 /*!
  * \internal
  * \brief Check whether a node has a specific attribute name/value
@@ -864,9 +862,7 @@ update_cib_stonith_devices(const char *event, xmlNode * msg)
 gboolean
 node_has_attr(const char *node, const char *name, const char *value)
 {
-    char xpath[XPATH_MAX];
     xmlNode *match;
-    int n;
 
     CRM_CHECK(local_cib != NULL, return FALSE);
 
@@ -875,13 +871,12 @@ node_has_attr(const char *node, const char *name, const char *value)
      * use id-ref to reference values elsewhere, that is intended for resources,
      * so we ignore that here.
      */
-    n = snprintf(xpath, XPATH_MAX, "//" XML_CIB_TAG_NODES
-                 "/" XML_CIB_TAG_NODE "[@uname='%s']/" XML_TAG_ATTR_SETS
-                 "/" XML_CIB_TAG_NVPAIR "[@name='%s' and @value='%s']",
-                 node, name, value);
-    match = get_xpath_object(xpath, local_cib, LOG_TRACE);
-
-    CRM_CHECK(n < XPATH_MAX, return FALSE);
+    match = crm_get_xpath_object_with("//" XML_CIB_TAG_NODES
+                                      "/" XML_CIB_TAG_NODE "[@uname=$node]/"
+                                      XML_TAG_ATTR_SETS "/" XML_CIB_TAG_NVPAIR
+                                      "[@name=$name and @value=$value]",
+                                      local_cib, LOG_TRACE, "node", node,
+                                      "name", name, "value", value, NULL);
     return (match != NULL);
 }
 
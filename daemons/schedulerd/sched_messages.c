@@ -14,6 +14,7 @@
 #include <crm/cib.h>
 #include <crm/msg_xml.h>
 #include <crm/common/xml.h>
+#include <crm/common/xml_internal.h>
 
 #include <glib.h>
 
@@ -51,7 +52,8 @@ gboolean process_pe_message(xmlNode * msg, xmlNode * xml_data, crm_client_t * se
 gboolean
 process_pe_message(xmlNode * msg, xmlNode * xml_data, crm_client_t * sender)
 {
-    static char *last_digest = NULL;
+    static uint64_t last_hash = 0;
+    static bool have_last_hash = FALSE;
     static char *filename = NULL;
 
     time_t execution_date = time(NULL);
@@ -78,7 +80,7 @@ process_pe_message(xmlNode * msg, xmlNode * xml_data, crm_client_t * sender)
         int seq = -1;
         int series_id = 0;
         int series_wrap = 0;
-        char *digest = NULL;
+        uint64_t hash = 0;
         const char *value = NULL;
         pe_working_set_t data_set;
         xmlNode *converted = NULL;
@@ -94,23 +96,25 @@ process_pe_message(xmlNode * msg, xmlNode * xml_data, crm_client_t * sender)
 
         set_working_set_defaults(&data_set);
 
-        digest = calculate_xml_versioned_digest(xml_data, FALSE, FALSE, CRM_FEATURE_SET);
+        /* Only equality with the previous input matters here, so a local
+         * hash is enough; no need for a full canonical digest.
+         */
+        hash = crm_xml_hash(xml_data);
         converted = copy_xml(xml_data);
-        if (cli_config_update(&converted, NULL, TRUE) == FALSE) {
+        /* The controller gets the CIB from the CIB manager, which validates it */
+        if (crm_config_update_trusted(&converted, NULL, TRUE) == FALSE) {
             data_set.graph = create_xml_node(NULL, XML_TAG_GRAPH);
             crm_xml_add_int(data_set.graph, "transition_id", 0);
             crm_xml_add_int(data_set.graph, "cluster-delay", 0);
             process = FALSE;
-            free(digest);
 
-        } else if (safe_str_eq(digest, last_digest)) {
+        } else if (have_last_hash && (hash == last_hash)) {
             crm_info("Input has not changed since last time, not saving to disk");
             is_repoke = TRUE;
-            free(digest);
 
         } else {
-            free(last_digest);
-            last_digest = digest;
+            last_hash = hash;
+            have_last_hash = TRUE;
         }
 
         if (process) {
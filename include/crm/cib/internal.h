@@ -59,11 +59,13 @@
 #  define F_CIB_CLIENTNAME	"cib_clientname"
 #  define F_CIB_NOTIFY_TYPE	"cib_notify_type"
 #  define F_CIB_NOTIFY_ACTIVATE	"cib_notify_activate"
+#  define F_CIB_NOTIFY_FILTER	"cib_notify_filter"
 #  define F_CIB_UPDATE_DIFF	"cib_update_diff"
 #  define F_CIB_USER		"cib_user"
 #  define F_CIB_LOCAL_NOTIFY_ID	"cib_local_notify_id"
 #  define F_CIB_PING_ID         "cib_ping_id"
 #  define F_CIB_SCHEMA_MAX      "cib_schema_max"
+#  define F_CIB_SYNC_VERSION    "cib_sync_version"
 
 #  define T_CIB			"cib"
 #  define T_CIB_NOTIFY		"cib_notify"
@@ -73,6 +75,12 @@
 #  define T_CIB_UPDATE_CONFIRM	"cib_update_confirmation"
 #  define T_CIB_REPLACE_NOTIFY	"cib_refresh_notify"
 
+/* Not a notification: a client registering for this accepts diff
+ * notifications merged together (or, past a size limit, replaced by one
+ * with no diff and F_CIB_RC set to -pcmk_err_diff_resync) when it falls behind
+ */
+#  define T_CIB_DIFF_COALESCE	"cib_diff_coalesce"
+
 #  define cib_channel_ro		"cib_ro"
 #  define cib_channel_rw		"cib_rw"
 #  define cib_channel_shm		"cib_shm"
@@ -127,6 +135,11 @@ xmlNode *cib_create_op(int call_id, const char *token, const char *op, const cha
 void cib_native_callback(cib_t * cib, xmlNode * msg, int call_id, int rc);
 void cib_native_notify(gpointer data, gpointer user_data);
 int cib_native_register_notification(cib_t * cib, const char *callback, int enabled);
+int cib_native_register_notification_full(cib_t *cib, const char *callback,
+                                          int enabled, const char *filter);
+int cib_remote_register_notification_full(cib_t *cib, const char *callback,
+                                          int enabled, const char *filter);
+int cib_client_set_diff_filter(cib_t *cib, const char *filter);
 gboolean cib_client_register_callback(cib_t * cib, int call_id, int timeout, gboolean only_success,
                                       void *user_data, const char *callback_name,
                                       void (*callback) (xmlNode *, int, int, xmlNode *, void *));
@@ -89,6 +89,7 @@ void crm_cluster_disconnect(crm_cluster_t * cluster);
 /* *INDENT-OFF* */
 enum crm_ais_msg_class {
     crm_class_cluster = 0,
+    crm_class_batch   = 1, /* several messages packed into one (internal) */
 };
 
 enum crm_ais_msg_types {
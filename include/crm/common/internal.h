@@ -11,6 +11,7 @@
 #include <glib.h>       /* for gboolean */
 #include <dirent.h>     /* for struct dirent */
 #include <unistd.h>     /* for getpid() */
+#include <stdint.h>     /* for uint8_t */
 #include <sys/types.h>  /* for uid_t and gid_t */
 
 #include <crm/common/logging.h>
@@ -43,6 +44,8 @@ unsigned int crm_procfs_num_cores(void);
 
 void crm_schema_init(void);
 void crm_schema_cleanup(void);
+gboolean crm_config_update_trusted(xmlNode **xml, int *best_version,
+                                   gboolean to_logs);
 
 
 /* internal functions related to process IDs (from pid.c) */
@@ -85,6 +88,25 @@ gboolean crm_ends_with_ext(const char *s, const char *match);
 char *add_list_element(char *list, const char *value);
 bool crm_compress_string(const char *data, int length, int max, char **result,
                          unsigned int *result_len);
+
+/* Codecs for compressed IPC payloads (peers that predate codec negotiation
+ * only know bzip2, so it must stay 0)
+ */
+enum pcmk__codec {
+    pcmk__codec_bzip2   = 0,
+    pcmk__codec_lz4     = 1,
+};
+
+#define pcmk__codec_mask(codec) ((uint8_t) (1 << (codec)))
+
+uint8_t pcmk__codecs_supported(void);
+enum pcmk__codec pcmk__codec_choose(uint8_t peer_codecs);
+const char *pcmk__codec_text(enum pcmk__codec codec);
+bool pcmk__compress(enum pcmk__codec codec, const char *data, int length,
+                    int max, char **result, unsigned int *result_len);
+int pcmk__decompress(enum pcmk__codec codec, const char *data,
+                     unsigned int length, char *result,
+                     unsigned int *result_len);
 gint crm_alpha_sort(gconstpointer a, gconstpointer b);
 
 static inline char *
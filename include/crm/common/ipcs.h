@@ -50,14 +50,32 @@ struct crm_remote_s {
     gnutls_session_t *tls_session;
     bool tls_handshake_complete;
 #  endif
+
+    uint8_t codecs;     /* Payload codecs the peer can decompress (0 if unknown) */
 };
 
 enum crm_client_flags
 {
     crm_client_flag_ipc_proxied    = 0x00001, /* ipc_proxy code only */
     crm_client_flag_ipc_privileged = 0x00002, /* root or cluster user */
+    crm_client_flag_ipc_handled    = 0x00004, /* last request answered by library */
 };
 
+/* Per-client IPC counters, reported by the CRM_OP_IPC_STATS request that
+ * every IPC server answers
+ */
+typedef struct crm_client_stats_s {
+    uint64_t requests;          /* Requests received */
+    uint64_t request_bytes;     /* Bytes received, as sent */
+    uint64_t responses;         /* Responses sent */
+    uint64_t events;            /* Events queued */
+    uint64_t sent_bytes;        /* Bytes sent or queued, as sent */
+    uint64_t uncompressed_bytes; /* Same, before any compression */
+    unsigned int queue_high;    /* Most events queued at once */
+    long long backlog_since_ms; /* When events last started piling up (or 0) */
+    long long backlog_max_ms;   /* Longest it has taken to clear a backlog */
+} crm_client_stats_t;
+
 struct crm_client_s {
     uint pid;
 
@@ -90,6 +108,16 @@ struct crm_client_s {
 
     unsigned int queue_backlog; /* IPC queue length after last flush */
     unsigned int queue_max;     /* Evict client whose queue grows this big */
+
+    uint8_t ipc_codecs;         /* IPC payload codecs the client can decompress */
+
+    /* Queued event that later ones may still be merged into, and the
+     * message it was prepared from (see pcmk__ipcs_send_mergeable())
+     */
+    struct iovec *mergeable_event;
+    xmlNode *mergeable_xml;
+
+    crm_client_stats_t stats;
 };
 
 extern GHashTable *client_connections;
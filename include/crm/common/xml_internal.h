@@ -25,9 +25,12 @@
 #  include <stdlib.h>
 #  include <stdio.h>
 #  include <string.h>
+#  include <stdint.h>
 
 #  include <crm/crm.h>  /* transitively imports qblog.h */
 
+#  include <libxml/xpath.h>
+
 
 /*!
  * \brief Base for directing lib{xml2,xslt} log into standard libqb backend
@@ -131,4 +134,42 @@ do {
     }                                                                           \
 } while (0)
 
+/*!
+ * \internal
+ * \brief Allocation counters for per-node XML private data
+ */
+typedef struct crm_xml_alloc_stats_s {
+    unsigned long long allocs;          /* private structs handed out */
+    unsigned long long frees;           /* private structs released */
+    unsigned long long slabs_created;   /* slabs obtained from the system */
+    unsigned long long slabs_freed;     /* slabs given back to the system */
+    unsigned long long deleted_objs;    /* deletions recorded while tracking */
+    unsigned long live;                 /* private structs currently in use */
+    unsigned long peak;                 /* highest value of live */
+} crm_xml_alloc_stats_t;
+
+void crm_xml_alloc_stats(crm_xml_alloc_stats_t *stats);
+
+uint64_t crm_xml_hash(xmlNode *xml);
+bool xml_changes_within(xmlNode *xml, const char *section);
+void xml_document_set_dirty(xmlNode *xml, bool dirty);
+
+/*!
+ * \internal
+ * \brief Counters for the compiled XPath expression cache
+ */
+typedef struct crm_xpath_cache_stats_s {
+    unsigned long long hits;            /* searches using a cached expression */
+    unsigned long long misses;          /* searches that compiled an expression */
+    unsigned long long flushes;         /* times the full cache was emptied */
+    unsigned int entries;               /* expressions currently cached */
+} crm_xpath_cache_stats_t;
+
+xmlXPathObjectPtr crm_xpath_search_with(xmlNode *xml_top, const char *path, ...)
+    G_GNUC_NULL_TERMINATED;
+xmlNode *crm_get_xpath_object_with(const char *xpath, xmlNode *xml_obj,
+                                   int error_level, ...) G_GNUC_NULL_TERMINATED;
+void crm_xpath_cache_stats(crm_xpath_cache_stats_t *stats);
+void crm_xpath_cleanup(void);
+
 #endif
@@ -172,7 +172,13 @@ char *generate_hash_key(const char *crm_msg_reference, const char *sys);
 /*! remote tcp/tls helper functions */
 typedef struct crm_remote_s crm_remote_t;
 
+/* Handshake attribute listing the payload codecs a peer can decompress */
+#  define F_REMOTE_CODECS "remote_codecs"
+
 int crm_remote_send(crm_remote_t * remote, xmlNode * msg);
+int crm_remote_send_text(crm_remote_t *remote, const char *text, size_t len);
+void crm_remote_add_codecs(xmlNode *msg);
+void crm_remote_set_codecs(crm_remote_t *remote, xmlNode *msg);
 int crm_remote_ready(crm_remote_t * remote, int total_timeout /*ms */ );
 gboolean crm_remote_recv(crm_remote_t * remote, int total_timeout /*ms */ , int *disconnected);
 xmlNode *crm_remote_parse_buffer(crm_remote_t * remote);
@@ -290,6 +296,24 @@ stonith_ipc_server_init(qb_ipcs_service_t **ipcs, struct qb_ipcs_service_handler
 qb_ipcs_service_t *
 crmd_ipc_server_init(struct qb_ipcs_service_handlers *cb);
 
+ssize_t pcmk__ipc_prepare(uint32_t request, xmlNode *message,
+                          struct iovec **result, uint32_t max_send_size,
+                          uint8_t peer_codecs);
+
+typedef struct pcmk__shared_msg_s pcmk__shared_msg_t;
+
+pcmk__shared_msg_t *pcmk__shared_msg_new(xmlNode *message);
+pcmk__shared_msg_t *pcmk__shared_msg_ref(pcmk__shared_msg_t *shared);
+void pcmk__shared_msg_unref(pcmk__shared_msg_t *shared);
+const char *pcmk__shared_msg_text(pcmk__shared_msg_t *shared, size_t *len);
+ssize_t pcmk__ipcs_send_shared(crm_client_t *c, pcmk__shared_msg_t *shared,
+                               enum crm_ipc_flags flags);
+
+typedef xmlNode *(*pcmk__ipc_merge_fn)(xmlNode *queued, xmlNode *message);
+
+ssize_t pcmk__ipcs_send_mergeable(crm_client_t *c, xmlNode *message,
+                                  pcmk__ipc_merge_fn merge);
+
 void cib_ipc_servers_init(qb_ipcs_service_t **ipcs_ro,
         qb_ipcs_service_t **ipcs_rw,
         qb_ipcs_service_t **ipcs_shm,
@@ -314,10 +338,16 @@ static inline void *realloc_safe(void *ptr, size_t size)
 
 const char *crm_xml_add_last_written(xmlNode *xml_node);
 void crm_xml_dump(xmlNode * data, int options, char **buffer, int *offset, int *max, int depth);
+size_t crm_xml_dump_len(xmlNode * data, int options, int depth);
+size_t crm_xml_dump_into(xmlNode * data, int options, int depth, char *out);
 void crm_buffer_add_char(char **buffer, int *offset, int *max, char c);
 
 gboolean crm_digest_verify(xmlNode *input, const char *expected);
 
+/* mainloop dispatch statistics and budget */
+xmlNode *mainloop_stats_xml(xmlNode *parent);
+int mainloop_dispatch_budget(void);
+
 /* cross-platform compatibility functions */
 char *crm_compat_realpath(const char *path);
 
@@ -351,4 +381,12 @@ void remote_proxy_free(gpointer data);
 void remote_proxy_relay_event(remote_proxy_t *proxy, xmlNode *msg);
 void remote_proxy_relay_response(remote_proxy_t *proxy, xmlNode *msg, int msg_id);
 
+/* Asynchronous executor requests */
+typedef void (*lrmd_reply_callback)(lrmd_t *lrmd, int rc, xmlNode *reply,
+                                    void *user_data);
+
+int lrmd_internal_send_async(lrmd_t *lrmd, const char *op, xmlNode *data,
+                             int timeout, enum lrmd_call_options options,
+                             lrmd_reply_callback callback, void *user_data);
+
 #endif                          /* CRM_INTERNAL__H */
@@ -488,6 +488,39 @@ cib_client_add_notify_callback(cib_t * cib, const char *event,
     return pcmk_ok;
 }
 
+/*!
+ * \internal
+ * \brief Limit the diff notifications the CIB manager sends this connection
+ *
+ * The CIB manager drops changes outside the given paths from each diff before
+ * sending it (without the digest, since the pruned diff can't be verified),
+ * and sends nothing at all if no change is left. A connection that keeps its
+ * own copy of the CIB up to date by applying diffs must not set a filter.
+ *
+ * \param[in] cib     CIB connection with a diff notification callback
+ * \param[in] filter  Space-separated list of CIB section names (such as
+ *                    "status" or "resources") and/or absolute paths (such as
+ *                    "/cib/configuration/fencing-topology"), or NULL to get
+ *                    every diff again
+ *
+ * \return pcmk_ok on success, -errno otherwise
+ * \note Adding another diff callback clears the filter, so set it afterward.
+ */
+int
+cib_client_set_diff_filter(cib_t *cib, const char *filter)
+{
+    switch (cib->variant) {
+        case cib_native:
+            return cib_native_register_notification_full(cib, T_CIB_DIFF_NOTIFY,
+                                                         1, filter);
+        case cib_remote:
+            return cib_remote_register_notification_full(cib, T_CIB_DIFF_NOTIFY,
+                                                         1, filter);
+        default:
+            return -EPROTONOSUPPORT;
+    }
+}
+
 static int 
 get_notify_list_event_count(cib_t * cib, const char *event)
 {
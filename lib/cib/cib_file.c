@@ -847,13 +847,13 @@ cib_file_perform_op_delegate(cib_t * cib, const char *op, const char *host, cons
     }
 
     if (output_data && output) {
-        if(output == in_mem_cib) {
+        if(output->doc == in_mem_cib->doc) {
             *output_data = copy_xml(output);
         } else {
             *output_data = output;
         }
 
-    } else if(output != in_mem_cib) {
+    } else if(output && (output->doc != in_mem_cib->doc)) {
         free_xml(output);
     }
 
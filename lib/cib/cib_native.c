@@ -488,6 +488,13 @@ cib_native_set_connection_dnotify(cib_t * cib, void (*dnotify) (gpointer user_da
 
 int
 cib_native_register_notification(cib_t * cib, const char *callback, int enabled)
+{
+    return cib_native_register_notification_full(cib, callback, enabled, NULL);
+}
+
+int
+cib_native_register_notification_full(cib_t *cib, const char *callback,
+                                      int enabled, const char *filter)
 {
     int rc = pcmk_ok;
     xmlNode *notify_msg = create_xml_node(NULL, "cib-callback");
@@ -497,6 +504,7 @@ cib_native_register_notification(cib_t * cib, const char *callback, int enabled)
         crm_xml_add(notify_msg, F_CIB_OPERATION, T_CIB_NOTIFY);
         crm_xml_add(notify_msg, F_CIB_NOTIFY_TYPE, callback);
         crm_xml_add_int(notify_msg, F_CIB_NOTIFY_ACTIVATE, enabled);
+        crm_xml_add(notify_msg, F_CIB_NOTIFY_FILTER, filter);
         rc = crm_ipc_send(native->ipc, notify_msg, crm_ipc_client_response,
                           1000 * cib->call_timeout, NULL);
         if (rc <= 0) {
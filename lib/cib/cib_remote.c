@@ -86,8 +86,9 @@ cib_remote_set_connection_dnotify(cib_t * cib, void (*dnotify) (gpointer user_da
     return -EPROTONOSUPPORT;
 }
 
-static int
-cib_remote_register_notification(cib_t * cib, const char *callback, int enabled)
+int
+cib_remote_register_notification_full(cib_t *cib, const char *callback,
+                                      int enabled, const char *filter)
 {
     xmlNode *notify_msg = create_xml_node(NULL, "cib_command");
     cib_remote_opaque_t *private = cib->variant_opaque;
@@ -95,11 +96,18 @@ cib_remote_register_notification(cib_t * cib, const char *callback, int enabled)
     crm_xml_add(notify_msg, F_CIB_OPERATION, T_CIB_NOTIFY);
     crm_xml_add(notify_msg, F_CIB_NOTIFY_TYPE, callback);
     crm_xml_add_int(notify_msg, F_CIB_NOTIFY_ACTIVATE, enabled);
+    crm_xml_add(notify_msg, F_CIB_NOTIFY_FILTER, filter);
     crm_remote_send(&private->callback, notify_msg);
     free_xml(notify_msg);
     return pcmk_ok;
 }
 
+static int
+cib_remote_register_notification(cib_t * cib, const char *callback, int enabled)
+{
+    return cib_remote_register_notification_full(cib, callback, enabled, NULL);
+}
+
 cib_t *
 cib_remote_new(const char *server, const char *user, const char *passwd, int port,
                gboolean encrypted)
@@ -249,6 +257,8 @@ cib_tls_signon(cib_t * cib, crm_remote_t * connection, gboolean event_channel)
     crm_xml_add(login, "user", private->user);
     crm_xml_add(login, "password", private->passwd);
     crm_xml_add(login, "hidden", "password");
+    connection->codecs = 0; // Until the server says otherwise
+    crm_remote_add_codecs(login);
 
     crm_remote_send(connection, login);
     free_xml(login);
@@ -279,6 +289,7 @@ cib_tls_signon(cib_t * cib, crm_remote_t * connection, gboolean event_channel)
 
         } else {
             connection->token = strdup(tmp_ticket);
+            crm_remote_set_codecs(connection, answer);
         }
     }
     free_xml(answer);
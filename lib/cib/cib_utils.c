@@ -30,6 +30,7 @@
 #include <crm/cib/internal.h>
 #include <crm/msg_xml.h>
 #include <crm/common/xml.h>
+#include <crm/common/xml_internal.h>
 #include <crm/pengine/rules.h>
 
 struct config_root_s {
@@ -266,18 +267,16 @@ cib_perform_op(const char *op, int call_options, cib_op_t * fn, gboolean is_quer
         } else if(cib_filtered == *output) {
             cib_filtered = NULL; /* Let them have this copy */
 
-        } else if(*output == current_cib) {
-            /* They already know not to free it */
-
         } else if(cib_filtered && (*output)->doc == cib_filtered->doc) {
             /* We're about to free the document of which *output is a part */
             *output = copy_xml(*output);
-
-        } else if((*output)->doc == current_cib->doc) {
-            /* Give them a copy they can free */
-            *output = copy_xml(*output);
         }
 
+        /* Anything else that is part of current_cib is returned as-is rather
+         * than copied, so callers must not free output from current_cib's
+         * document (and must be done with it before current_cib changes)
+         */
+
         free_xml(cib_filtered);
         return rc;
     }
@@ -366,6 +365,15 @@ cib_perform_op(const char *op, int call_options, cib_op_t * fn, gboolean is_quer
     strip_text_nodes(scratch);
     fix_plus_plus_recursive(scratch);
 
+    if (check_schema && xml_changes_within(scratch, XML_CIB_TAG_STATUS)) {
+        /* The status schema accepts anything, so a change confined to the
+         * status section cannot make a valid CIB invalid.  Checked before
+         * the patchset is created, which updates the version counters.
+         */
+        crm_trace("Skipping validation of status-only %s op", op);
+        check_schema = FALSE;
+    }
+
     if (is_set(call_options, cib_zero_copy)) {
         /* At this point, current_cib is just the 'cib' tag and its properties,
          *
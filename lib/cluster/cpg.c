@@ -7,6 +7,7 @@
 
 #include <crm_internal.h>
 #include <bzlib.h>
+#include <stddef.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -28,8 +29,11 @@
 #include <crm/msg_xml.h>
 
 cpg_handle_t pcmk_cpg_handle = 0; /* TODO: Remove, use cluster.cpg_handle */
+GListPtr cs_message_queue = NULL;
+int cs_message_timer = 0;
 
 static bool cpg_evicted = FALSE;
+static cpg_deliver_fn_t cpg_deliver_fn = NULL;
 gboolean(*pcmk_cpg_dispatch_fn) (int kind, const char *from, const char *data) = NULL;
 
 #define cs_repeat(counter, max, code) do {		\
@@ -43,9 +47,18 @@ gboolean(*pcmk_cpg_dispatch_fn) (int kind, const char *from, const char *data) =
         }                                               \
     } while(counter < max)
 
+static ssize_t crm_cs_flush(gpointer data);
+
 void
 cluster_disconnect_cpg(crm_cluster_t *cluster)
 {
+    if (cs_message_timer && cluster->cpg_handle) {
+        /* Messages may still be waiting to be batched, try once more */
+        g_source_remove(cs_message_timer);
+        cs_message_timer = 0;
+        crm_cs_flush(&pcmk_cpg_handle);
+    }
+
     pcmk_cpg_handle = 0;
     if (cluster->cpg_handle) {
         crm_trace("Disconnecting CPG");
@@ -92,12 +105,6 @@ uint32_t get_local_nodeid(cpg_handle_t handle)
     return local_nodeid;
 }
 
-
-GListPtr cs_message_queue = NULL;
-int cs_message_timer = 0;
-
-static ssize_t crm_cs_flush(gpointer data);
-
 static gboolean
 crm_cs_flush_cb(gpointer data)
 {
@@ -107,6 +114,89 @@ crm_cs_flush_cb(gpointer data)
 }
 
 #define CS_SEND_MAX 200
+
+/* Most bytes of queued messages to pack into a single batch */
+#define CS_BATCH_MAX (64 * 1024)
+
+/* Messages in a batch start on 8-byte boundaries, like the header expects */
+#define CS_BATCH_ALIGN(len) (((len) + 7) & ~((size_t) 7))
+
+/*!
+ * \internal
+ * \brief Check whether queued messages should be sent in batches
+ *
+ * \return TRUE if PCMK_cpg_batch is enabled, FALSE otherwise
+ * \note Peers that predate batches can't unpack them, so this must only be
+ *       enabled once every cluster node understands them.
+ */
+static gboolean
+cs_batching(void)
+{
+    static int batching = -1;
+
+    if (batching < 0) {
+        batching = crm_is_true(daemon_option("cpg_batch"));
+    }
+    return batching;
+}
+
+/*!
+ * \internal
+ * \brief Pack messages from the head of the send queue into one
+ *
+ * \param[out] count  Where to store the number of messages packed
+ *
+ * \return Newly allocated batch message, or NULL if fewer than two
+ *         queued messages fit in one
+ * \note Messages keep their own destinations; each recipient picks out the
+ *       ones meant for it when the batch is unpacked.
+ */
+static AIS_Message *
+cs_pack_batch(int *count)
+{
+    size_t total = CS_BATCH_ALIGN(sizeof(AIS_Message));
+    size_t offset = 0;
+    AIS_Message *batch = NULL;
+    GList *iter = NULL;
+    int lpc = 0;
+
+    *count = 0;
+    for (iter = cs_message_queue; iter != NULL; iter = iter->next) {
+        struct iovec *iov = iter->data;
+
+        if ((total + CS_BATCH_ALIGN(iov->iov_len)) > CS_BATCH_MAX) {
+            break;
+        }
+        total += CS_BATCH_ALIGN(iov->iov_len);
+        (*count)++;
+    }
+    if (*count < 2) {
+        return NULL;
+    }
+
+    batch = calloc(1, total);
+    CRM_ASSERT(batch != NULL);
+
+    /* The sender details are the same for every message we queue */
+    memcpy(batch, ((struct iovec *) cs_message_queue->data)->iov_base,
+           sizeof(AIS_Message));
+    memset(&(batch->host), 0, sizeof(AIS_Host));
+    batch->header.id = crm_class_batch;
+    batch->header.size = total;
+    batch->is_compressed = FALSE;
+    batch->compressed_size = 0;
+    batch->size = total - sizeof(AIS_Message);
+
+    offset = CS_BATCH_ALIGN(sizeof(AIS_Message));
+    for (iter = cs_message_queue; lpc < *count; iter = iter->next, lpc++) {
+        struct iovec *iov = iter->data;
+
+        memcpy(((char *) batch) + offset, iov->iov_base, iov->iov_len);
+        offset += CS_BATCH_ALIGN(iov->iov_len);
+    }
+    return batch;
+}
+
 static ssize_t
 crm_cs_flush(gpointer data)
 {
@@ -137,6 +227,33 @@ crm_cs_flush(gpointer data)
 
     while (cs_message_queue && sent < CS_SEND_MAX) {
         struct iovec *iov = cs_message_queue->data;
+        int count = 0;
+        AIS_Message *batch = cs_batching()? cs_pack_batch(&count) : NULL;
+
+        if (batch != NULL) {
+            struct iovec batch_iov = { batch, batch->header.size };
+
+            errno = 0;
+            rc = cpg_mcast_joined(*handle, CPG_TYPE_AGREED, &batch_iov, 1);
+            free(batch);
+
+            if (rc != CS_OK) {
+                break;
+            }
+
+            crm_trace("Sent %d CPG messages in one, size=%llu",
+                      count, (unsigned long long) batch_iov.iov_len);
+            sent += count;
+            last_sent += count;
+            for (; count > 0; count--) {
+                iov = cs_message_queue->data;
+                cs_message_queue = g_list_delete_link(cs_message_queue,
+                                                      cs_message_queue);
+                free(iov->iov_base);
+                free(iov);
+            }
+            continue;
+        }
 
         errno = 0;
         rc = cpg_mcast_joined(*handle, CPG_TYPE_AGREED, iov, 1);
@@ -187,10 +304,71 @@ send_cpg_iov(struct iovec * iov)
     crm_trace("Queueing CPG message %u (%llu bytes)",
               queued, (unsigned long long) iov->iov_len);
     cs_message_queue = g_list_append(cs_message_queue, iov);
+
+    if (cs_batching()) {
+        /* Let everything sent before returning to the mainloop be batched.
+         * The flush must not wait for the mainloop to be idle, which it may
+         * never be under the load batching is meant for.
+         */
+        if (cs_message_timer == 0) {
+            cs_message_timer = g_idle_add_full(G_PRIORITY_DEFAULT,
+                                               crm_cs_flush_cb,
+                                               &pcmk_cpg_handle, NULL);
+        }
+        return TRUE;
+    }
     crm_cs_flush(&pcmk_cpg_handle);
     return TRUE;
 }
 
+/*!
+ * \internal
+ * \brief Pass each message in a CPG delivery to the daemon's handler
+ *
+ * Batches are unpacked, and each message in them delivered separately, as
+ * if it had arrived on its own.
+ */
+static void
+pcmk_cpg_deliver(cpg_handle_t handle, const struct cpg_name *groupName,
+                 uint32_t nodeid, uint32_t pid, void *msg, size_t msg_len)
+{
+    AIS_Message *batch = msg;
+    size_t offset = CS_BATCH_ALIGN(sizeof(AIS_Message));
+
+    if (cpg_deliver_fn == NULL) {
+        return;
+
+    } else if ((msg_len < sizeof(AIS_Message))
+               || (batch->header.id != crm_class_batch)) {
+        cpg_deliver_fn(handle, groupName, nodeid, pid, msg, msg_len);
+        return;
+    }
+
+    while ((offset + sizeof(AIS_Message)) <= msg_len) {
+        AIS_Message *inner = NULL;
+        int32_t size = 0;
+
+        memcpy(&size, ((char *) msg) + offset + offsetof(AIS_Message, header.size),
+               sizeof(size));
+        if ((size < (int32_t) sizeof(AIS_Message)) || ((offset + size) > msg_len)) {
+            crm_err("Discarding rest of invalid CPG batch from %u.%u "
+                    CRM_XS " offset=%llu size=%d total=%llu", nodeid, pid,
+                    (unsigned long long) offset, size,
+                    (unsigned long long) msg_len);
+            return;
+        }
+
+        /* Copy it, since handlers may modify it in place */
+        inner = malloc(size);
+        CRM_ASSERT(inner != NULL);
+        memcpy(inner, ((char *) msg) + offset, size);
+        cpg_deliver_fn(handle, groupName, nodeid, pid, inner, size);
+        free(inner);
+
+        offset += CS_BATCH_ALIGN(size);
+    }
+}
+
 static int
 pcmk_cpg_dispatch(gpointer user_data)
 {
@@ -411,12 +589,13 @@ cluster_connect_cpg(crm_cluster_t *cluster)
     };
 
     cpg_callbacks_t cpg_callbacks = {
-        .cpg_deliver_fn = cluster->cpg.cpg_deliver_fn,
+        .cpg_deliver_fn = pcmk_cpg_deliver,
         .cpg_confchg_fn = cluster->cpg.cpg_confchg_fn,
-        /* .cpg_deliver_fn = pcmk_cpg_deliver, */
         /* .cpg_confchg_fn = pcmk_cpg_membership, */
     };
 
+    cpg_deliver_fn = cluster->cpg.cpg_deliver_fn;
+
     cpg_evicted = FALSE;
     cluster->group.length = 0;
     cluster->group.value[0] = 0;
@@ -39,13 +39,16 @@
 static char *
 dump_xml_for_digest(xmlNode * an_xml_node)
 {
-    char *buffer = NULL;
-    int offset = 0, max = 0;
+    size_t len = crm_xml_dump_len(an_xml_node, 0, 0);
+    char *buffer = malloc(len + 3);
+
+    CRM_ASSERT(buffer != NULL);
 
     /* for compatibility with the old result which is used for v1 digests */
-    crm_buffer_add_char(&buffer, &offset, &max, ' ');
-    crm_xml_dump(an_xml_node, 0, &buffer, &offset, &max, 0);
-    crm_buffer_add_char(&buffer, &offset, &max, '\n');
+    buffer[0] = ' ';
+    crm_xml_dump_into(an_xml_node, 0, 0, buffer + 1);
+    buffer[len + 1] = '\n';
+    buffer[len + 2] = 0;
 
     return buffer;
 }
@@ -13,11 +13,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
 #include <grp.h>
 
 #include <errno.h>
 #include <fcntl.h>
-#include <bzlib.h>
 
 #include <crm/crm.h>
 #include <crm/msg_xml.h>
@@ -35,6 +35,12 @@ struct crm_ipc_response_header {
     uint32_t size_compressed;
     uint32_t flags;
     uint8_t  version; /* Protect against version changes for anyone that might bother to statically link us */
+
+    /* These used to be padding, which older peers zero and ignore, so they
+     * send 0 (bzip2) for both and only ever get bzip2 back
+     */
+    uint8_t  codec;   /* enum pcmk__codec used for a compressed payload */
+    uint8_t  codecs;  /* Codecs the sender can decompress (pcmk__codec_mask) */
 };
 
 static int hdr_offset = 0;
@@ -384,6 +390,8 @@ add_event(crm_client_t *c, struct iovec *iov)
         c->event_queue = g_queue_new();
     }
     g_queue_push_tail(c->event_queue, iov);
+    c->stats.queue_high = QB_MAX(c->stats.queue_high,
+                                 g_queue_get_length(c->event_queue));
 }
 
 void
@@ -414,6 +422,9 @@ crm_client_destroy(crm_client_t * c)
         crm_debug("Destroying %d events", g_queue_get_length(c->event_queue));
         g_queue_free_full(c->event_queue, free_event);
     }
+    if (c->mergeable_xml) {
+        free_xml(c->mergeable_xml);
+    }
 
     free(c->id);
     free(c->name);
@@ -460,14 +471,97 @@ crm_ipcs_client_pid(qb_ipcs_connection_t * c)
     return stats.client_pid;
 }
 
+static long long
+ipc_now_ms(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000LL) + (now.tv_nsec / 1000000);
+#else
+    return time(NULL) * 1000LL;
+#endif
+}
+
+static void
+stats_add(xmlNode *xml, const char *name, unsigned long long value)
+{
+    char buffer[32];
+
+    snprintf(buffer, sizeof(buffer), "%llu", value);
+    crm_xml_add(xml, name, buffer);
+}
+
+/*!
+ * \internal
+ * \brief Describe the IPC statistics of every client of this server
+ *
+ * \return Newly allocated XML with one child per client (plus mainloop
+ *         dispatch statistics, if enabled)
+ */
+static xmlNode *
+crm_ipcs_stats_xml(void)
+{
+    GHashTableIter iter;
+    crm_client_t *c = NULL;
+    long long now = ipc_now_ms();
+    xmlNode *stats = create_xml_node(NULL, CRM_OP_IPC_STATS);
+
+    crm_xml_add(stats, "server", crm_system_name);
+    mainloop_stats_xml(stats);
+    if (client_connections == NULL) {
+        return stats;
+    }
+
+    g_hash_table_iter_init(&iter, client_connections);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &c)) {
+        xmlNode *client = create_xml_node(stats, "client");
+
+        crm_xml_add(client, XML_ATTR_ID, c->id);
+        crm_xml_add(client, XML_ATTR_UNAME, crm_client_name(c));
+        crm_xml_add_int(client, "pid", c->pid);
+        crm_xml_add(client, "kind", crm_client_type_text(c->kind));
+        stats_add(client, "requests", c->stats.requests);
+        stats_add(client, "request-bytes", c->stats.request_bytes);
+        stats_add(client, "responses", c->stats.responses);
+        stats_add(client, "events", c->stats.events);
+        stats_add(client, "sent-bytes", c->stats.sent_bytes);
+        stats_add(client, "uncompressed-bytes", c->stats.uncompressed_bytes);
+        crm_xml_add_int(client, "queue-length",
+                        c->event_queue? g_queue_get_length(c->event_queue) : 0);
+        crm_xml_add_int(client, "queue-max",
+                        QB_MAX(c->queue_max, PCMK_IPC_DEFAULT_QUEUE_MAX));
+        crm_xml_add_int(client, "queue-high", c->stats.queue_high);
+        stats_add(client, "backlog-ms",
+                  c->stats.backlog_since_ms? (now - c->stats.backlog_since_ms) : 0);
+        stats_add(client, "backlog-max-ms", c->stats.backlog_max_ms);
+    }
+    return stats;
+}
+
 xmlNode *
 crm_ipcs_recv(crm_client_t * c, void *data, size_t size, uint32_t * id, uint32_t * flags)
 {
+    /* Requests are parsed before the next one is read, so one decompression
+     * buffer can be reused for all of them
+     */
+    static char *uncompressed = NULL;
+    static unsigned int uncompressed_size = 0;
+
     xmlNode *xml = NULL;
-    char *uncompressed = NULL;
     char *text = ((char *)data) + sizeof(struct crm_ipc_response_header);
     struct crm_ipc_response_header *header = data;
 
+    /* The caller rejects messages from unknown connections once it has the
+     * message, so c may be NULL here
+     */
+    if (c != NULL) {
+        c->flags &= ~crm_client_flag_ipc_handled;
+        c->stats.requests++;
+        c->stats.request_bytes += size;
+    }
+
     if (id) {
         *id = ((struct qb_ipc_response_header *)data)->id;
     }
@@ -489,21 +583,31 @@ crm_ipcs_recv(crm_client_t * c, void *data, size_t size, uint32_t * id, uint32_t
         return NULL;
     }
 
+    /* Replies and events to this client may use any codec it can decompress */
+    if (c != NULL) {
+        c->ipc_codecs = header->codecs;
+    }
+
     if (header->size_compressed) {
         int rc = 0;
         unsigned int size_u = 1 + header->size_uncompressed;
-        uncompressed = calloc(1, size_u);
 
-        crm_trace("Decompressing message data %u bytes into %u bytes",
-                  header->size_compressed, size_u);
+        if (uncompressed_size < size_u) {
+            free(uncompressed);
+            uncompressed = malloc(size_u);
+            CRM_ASSERT(uncompressed != NULL);
+            uncompressed_size = size_u;
+        }
+
+        crm_trace("Decompressing message data %u bytes into %u bytes with %s",
+                  header->size_compressed, size_u,
+                  pcmk__codec_text(header->codec));
 
-        rc = BZ2_bzBuffToBuffDecompress(uncompressed, &size_u, text, header->size_compressed, 1, 0);
+        rc = pcmk__decompress(header->codec, text, header->size_compressed,
+                              uncompressed, &size_u);
         text = uncompressed;
 
-        if (rc != BZ_OK) {
-            crm_err("Decompression failed: %s " CRM_XS " bzerror=%d",
-                    bz2_strerror(rc), rc);
-            free(uncompressed);
+        if (rc != pcmk_ok) {
             return NULL;
         }
     }
@@ -513,12 +617,43 @@ crm_ipcs_recv(crm_client_t * c, void *data, size_t size, uint32_t * id, uint32_t
     crm_trace("Received %.200s", text);
     xml = string2xml(text);
 
-    free(uncompressed);
+    if (xml && c && safe_str_eq(crm_element_value(xml, F_CRM_TASK), CRM_OP_IPC_STATS)) {
+        /* Answer this here, so that every server supports it (but only to
+         * root and the cluster user, as it describes every other client)
+         */
+        xmlNode *reply = NULL;
+
+        if (is_set(c->flags, crm_client_flag_ipc_privileged)) {
+            reply = crm_ipcs_stats_xml();
+            crm_debug("Sending IPC statistics to %s", crm_client_name(c));
+
+        } else {
+            reply = create_xml_node(NULL, CRM_OP_IPC_STATS);
+            crm_xml_add_int(reply, "rc", -EACCES);
+            crm_warn("Refusing IPC statistics to unprivileged client %s",
+                     crm_client_name(c));
+        }
+        crm_ipcs_send(c, header->qb.id, reply, crm_ipc_flags_none);
+        free_xml(reply);
+        free_xml(xml);
+
+        /* The server will see no request, so must not acknowledge it */
+        c->flags |= crm_client_flag_ipc_handled;
+        return NULL;
+    }
     return xml;
 }
 
 ssize_t crm_ipcs_flush_events(crm_client_t * c);
 
+static void
+forget_mergeable_event(crm_client_t *c)
+{
+    c->mergeable_event = NULL;
+    free_xml(c->mergeable_xml);
+    c->mergeable_xml = NULL;
+}
+
 static gboolean
 crm_ipcs_flush_events_cb(gpointer data)
 {
@@ -581,6 +716,9 @@ crm_ipcs_flush_events(crm_client_t * c)
             break;
         }
         event = g_queue_pop_head(c->event_queue);
+        if (event == c->mergeable_event) {
+            forget_mergeable_event(c);
+        }
 
         sent++;
         header = event[0].iov_base;
@@ -596,6 +734,15 @@ crm_ipcs_flush_events(crm_client_t * c)
     }
 
     queue_len -= sent;
+    if (queue_len && (c->stats.backlog_since_ms == 0)) {
+        c->stats.backlog_since_ms = ipc_now_ms();
+
+    } else if ((queue_len == 0) && c->stats.backlog_since_ms) {
+        c->stats.backlog_max_ms = QB_MAX(c->stats.backlog_max_ms,
+                                         ipc_now_ms() - c->stats.backlog_since_ms);
+        c->stats.backlog_since_ms = 0;
+    }
+
     if (sent > 0 || queue_len) {
         crm_trace("Sent %d events (%d remaining) for %p[%d]: %s (%lld)",
                   sent, queue_len, c->ipcs, c->pid,
@@ -633,14 +780,18 @@ crm_ipcs_flush_events(crm_client_t * c)
     return rc;
 }
 
-ssize_t
-crm_ipc_prepare(uint32_t request, xmlNode * message, struct iovec ** result, uint32_t max_send_size)
+/* Same as pcmk__ipc_prepare(), for an already serialized message, which the
+ * result takes ownership of (message is only used for logging, if given)
+ */
+static ssize_t
+ipc_prepare_text(uint32_t request, xmlNode *message, char *buffer,
+                 struct iovec **result, uint32_t max_send_size,
+                 uint8_t peer_codecs)
 {
     static unsigned int biggest = 0;
     struct iovec *iov;
     unsigned int total = 0;
     char *compressed = NULL;
-    char *buffer = dump_xml_unformatted(message);
     struct crm_ipc_response_header *header = calloc(1, sizeof(struct crm_ipc_response_header));
 
     CRM_ASSERT(result != NULL);
@@ -659,6 +810,7 @@ crm_ipc_prepare(uint32_t request, xmlNode * message, struct iovec ** result, uin
     iov[0].iov_base = header;
 
     header->version = PCMK_IPC_VERSION;
+    header->codecs = pcmk__codecs_supported();
     header->size_uncompressed = 1 + strlen(buffer);
     total = iov[0].iov_len + header->size_uncompressed;
 
@@ -668,11 +820,24 @@ crm_ipc_prepare(uint32_t request, xmlNode * message, struct iovec ** result, uin
 
     } else {
         unsigned int new_size = 0;
+        enum pcmk__codec codec = pcmk__codec_choose(peer_codecs);
+        bool compressed_ok = pcmk__compress(codec, buffer,
+                                            header->size_uncompressed,
+                                            max_send_size, &compressed,
+                                            &new_size);
+
+        if (!compressed_ok && (codec != pcmk__codec_bzip2)) {
+            /* bzip2 is slower but compresses further, so it may still fit */
+            codec = pcmk__codec_bzip2;
+            compressed_ok = pcmk__compress(codec, buffer,
+                                           header->size_uncompressed,
+                                           max_send_size, &compressed,
+                                           &new_size);
+        }
 
-        if (crm_compress_string
-            (buffer, header->size_uncompressed, max_send_size, &compressed, &new_size)) {
-
+        if (compressed_ok) {
             header->flags |= crm_ipc_compressed;
+            header->codec = codec;
             header->size_compressed = new_size;
 
             iov[1].iov_len = header->size_compressed;
@@ -685,7 +850,9 @@ crm_ipc_prepare(uint32_t request, xmlNode * message, struct iovec ** result, uin
         } else {
             ssize_t rc = -EMSGSIZE;
 
-            crm_log_xml_trace(message, "EMSGSIZE");
+            if (message) {
+                crm_log_xml_trace(message, "EMSGSIZE");
+            }
             biggest = QB_MAX(header->size_uncompressed, biggest);
 
             crm_err
@@ -707,6 +874,35 @@ crm_ipc_prepare(uint32_t request, xmlNode * message, struct iovec ** result, uin
     return header->qb.size;
 }
 
+/*!
+ * \internal
+ * \brief Create an I/O vector for sending an IPC message to a known peer
+ *
+ * \param[in]  request        Identifier for libqb response header
+ * \param[in]  message        XML message to send
+ * \param[out] result         Where to store newly allocated I/O vector
+ * \param[in]  max_send_size  Compress the message if it is bigger than this
+ *                            (or 0 for the default IPC buffer size)
+ * \param[in]  peer_codecs    Codecs the recipient can decompress (as
+ *                            advertised in its messages, or 0 if unknown)
+ *
+ * \return Size of message on success, -errno otherwise
+ */
+ssize_t
+pcmk__ipc_prepare(uint32_t request, xmlNode *message, struct iovec **result,
+                  uint32_t max_send_size, uint8_t peer_codecs)
+{
+    return ipc_prepare_text(request, message, dump_xml_unformatted(message),
+                            result, max_send_size, peer_codecs);
+}
+
+ssize_t
+crm_ipc_prepare(uint32_t request, xmlNode * message, struct iovec ** result, uint32_t max_send_size)
+{
+    /* The recipient is unknown, so stick to what every peer can decompress */
+    return pcmk__ipc_prepare(request, message, result, max_send_size, 0);
+}
+
 ssize_t
 crm_ipcs_sendv(crm_client_t * c, struct iovec * iov, enum crm_ipc_flags flags)
 {
@@ -725,7 +921,10 @@ crm_ipcs_sendv(crm_client_t * c, struct iovec * iov, enum crm_ipc_flags flags)
     }
 
     header->flags |= flags;
+    c->stats.sent_bytes += header->qb.size;
+    c->stats.uncompressed_bytes += hdr_offset + header->size_uncompressed;
     if (flags & crm_ipc_server_event) {
+        c->stats.events++;
         header->qb.id = id++;   /* We don't really use it, but doesn't hurt to set one */
 
         if (flags & crm_ipc_server_free) {
@@ -748,6 +947,7 @@ crm_ipcs_sendv(crm_client_t * c, struct iovec * iov, enum crm_ipc_flags flags)
         }
 
     } else {
+        c->stats.responses++;
         CRM_LOG_ASSERT(header->qb.id != 0);     /* Replying to a specific request */
 
         rc = qb_ipcs_response_sendv(c->ipcs, iov, 2);
@@ -792,7 +992,8 @@ crm_ipcs_send(crm_client_t * c, uint32_t request, xmlNode * message,
     }
     crm_ipc_init();
 
-    rc = crm_ipc_prepare(request, message, &iov, ipc_buffer_max);
+    rc = pcmk__ipc_prepare(request, message, &iov, ipc_buffer_max,
+                           c->ipc_codecs);
     if (rc > 0) {
         rc = crm_ipcs_sendv(c, iov, flags | crm_ipc_server_free);
     } else {
@@ -803,11 +1004,209 @@ crm_ipcs_send(crm_client_t * c, uint32_t request, xmlNode * message,
     return rc;
 }
 
+/* A message serialized once for sending to many IPC and remote clients */
+struct pcmk__shared_msg_s {
+    int refs;
+    char *text;
+    size_t len;         /* Including the terminator */
+
+    /* IPC events prepared from text, per codec chosen for a client */
+    struct iovec *events[pcmk__codec_lz4 + 1];
+};
+
+/*!
+ * \internal
+ * \brief Serialize a message for sending to many clients
+ *
+ * \param[in] message  XML to send (not needed once this returns)
+ *
+ * \return Newly allocated shared message, with one reference
+ * \note Release the reference with pcmk__shared_msg_unref().
+ */
+pcmk__shared_msg_t *
+pcmk__shared_msg_new(xmlNode *message)
+{
+    pcmk__shared_msg_t *shared = calloc(1, sizeof(pcmk__shared_msg_t));
+
+    CRM_ASSERT(shared != NULL);
+    shared->refs = 1;
+    shared->text = dump_xml_unformatted(message);
+    CRM_ASSERT(shared->text != NULL);
+    shared->len = 1 + strlen(shared->text);
+    return shared;
+}
+
+pcmk__shared_msg_t *
+pcmk__shared_msg_ref(pcmk__shared_msg_t *shared)
+{
+    CRM_ASSERT((shared != NULL) && (shared->refs > 0));
+    shared->refs++;
+    return shared;
+}
+
+void
+pcmk__shared_msg_unref(pcmk__shared_msg_t *shared)
+{
+    int lpc = 0;
+
+    if ((shared == NULL) || (--shared->refs > 0)) {
+        return;
+    }
+    for (lpc = 0; lpc <= pcmk__codec_lz4; lpc++) {
+        pcmk_free_ipc_event(shared->events[lpc]);
+    }
+    free(shared->text);
+    free(shared);
+}
+
+/*!
+ * \internal
+ * \brief Get the serialized form of a shared message
+ *
+ * \param[in]  shared  Shared message
+ * \param[out] len     If not NULL, where to store length (with terminator)
+ *
+ * \return Serialized message (owned by \p shared)
+ */
+const char *
+pcmk__shared_msg_text(pcmk__shared_msg_t *shared, size_t *len)
+{
+    if (len) {
+        *len = shared->len;
+    }
+    return shared->text;
+}
+
+/*!
+ * \internal
+ * \brief Send a shared message to an IPC client as an event
+ *
+ * \param[in] c       Client to send to
+ * \param[in] shared  Message to send
+ * \param[in] flags   Bitmask of crm_ipc_flags (crm_ipc_server_event is
+ *                    implied, and crm_ipc_server_free is ignored)
+ *
+ * \return As crm_ipcs_sendv()
+ * \note The message is only compressed once for all clients that get the
+ *       same codec.
+ */
+ssize_t
+pcmk__ipcs_send_shared(crm_client_t *c, pcmk__shared_msg_t *shared,
+                       enum crm_ipc_flags flags)
+{
+    enum pcmk__codec codec = pcmk__codec_choose(c->ipc_codecs);
+
+    crm_ipc_init();
+
+    if (shared->events[codec] == NULL) {
+        ssize_t rc = ipc_prepare_text(0, NULL, strdup(shared->text),
+                                      &(shared->events[codec]), ipc_buffer_max,
+                                      pcmk__codec_mask(codec));
+
+        if (rc <= 0) {
+            crm_notice("Message to pid %d failed: %s " CRM_XS " rc=%lld ipcs=%p",
+                       c->pid, pcmk_strerror(rc), (long long) rc, c->ipcs);
+            return rc;
+        }
+    }
+
+    flags &= ~crm_ipc_server_free;
+    return crm_ipcs_sendv(c, shared->events[codec], flags | crm_ipc_server_event);
+}
+
+/*!
+ * \internal
+ * \brief Send an event that may be merged into the client's queued one
+ *
+ * If the last event sent with this function is still waiting at the end of
+ * the client's queue, \p merge is asked to combine it with \p message, and the
+ * result replaces it.  Otherwise \p message is queued as usual, and remembered
+ * for merging if it could not be sent straight away.
+ *
+ * \param[in] c        Client to send to
+ * \param[in] message  Event to send
+ * \param[in] merge    Function returning a newly allocated combination of a
+ *                     queued event and a new one (or NULL if they can't be)
+ *
+ * \return As crm_ipcs_sendv()
+ */
+ssize_t
+pcmk__ipcs_send_mergeable(crm_client_t *c, xmlNode *message,
+                          pcmk__ipc_merge_fn merge)
+{
+    ssize_t rc = 0;
+    struct iovec *iov = NULL;
+
+    crm_ipc_init();
+
+    if (c->mergeable_event && c->event_queue
+        && (g_queue_peek_tail(c->event_queue) == c->mergeable_event)) {
+
+        xmlNode *merged = merge(c->mergeable_xml, message);
+
+        if (merged) {
+            struct crm_ipc_response_header *old_header = c->mergeable_event[0].iov_base;
+            struct crm_ipc_response_header *header = NULL;
+
+            rc = pcmk__ipc_prepare(0, merged, &iov, ipc_buffer_max,
+                                   c->ipc_codecs);
+            if (rc <= 0) {
+                free_xml(merged);
+                pcmk_free_ipc_event(iov);
+                return rc;
+            }
+
+            /* Take the place (and id) of the queued event, keeping how it
+             * was to be delivered but not how its payload was encoded
+             */
+            header = iov[0].iov_base;
+            header->flags |= old_header->flags
+                             & (crm_ipc_server_event
+                                | crm_ipc_proxied_relay_response);
+            header->qb.id = old_header->qb.id;
+            c->event_queue->tail->data = iov;
+            pcmk_free_ipc_event(c->mergeable_event);
+
+            crm_trace("Merged event into %d queued for %p[%d]",
+                      header->qb.id, c->ipcs, c->pid);
+            free_xml(c->mergeable_xml);
+            c->mergeable_xml = merged;
+            c->mergeable_event = iov;
+            return crm_ipcs_flush_events(c);
+        }
+    }
+
+    forget_mergeable_event(c);
+
+    rc = pcmk__ipc_prepare(0, message, &iov, ipc_buffer_max, c->ipc_codecs);
+    if (rc <= 0) {
+        pcmk_free_ipc_event(iov);
+        crm_notice("Message to pid %d failed: %s " CRM_XS " rc=%lld ipcs=%p",
+                   c->pid, pcmk_strerror(rc), (long long) rc, c->ipcs);
+        return rc;
+    }
+
+    rc = crm_ipcs_sendv(c, iov, crm_ipc_server_event | crm_ipc_server_free);
+
+    /* Nothing else can have been queued since, so if iov is at the tail of
+     * the queue, it has not been sent (or freed) yet
+     */
+    if (c->event_queue && (g_queue_peek_tail(c->event_queue) == iov)) {
+        c->mergeable_event = iov;
+        c->mergeable_xml = copy_xml(message);
+    }
+    return rc;
+}
+
 void
 crm_ipcs_send_ack(crm_client_t * c, uint32_t request, uint32_t flags, const char *tag, const char *function,
                   int line)
 {
-    if (flags & crm_ipc_client_response) {
+    if (is_set(c->flags, crm_client_flag_ipc_handled)) {
+        /* The library already replied to this request */
+        c->flags &= ~crm_client_flag_ipc_handled;
+
+    } else if (flags & crm_ipc_client_response) {
         xmlNode *ack = create_xml_node(NULL, tag);
 
         crm_trace("Ack'ing msg from %s (%p)", crm_client_name(c), c);
@@ -836,6 +1235,15 @@ struct crm_ipc_s {
     char *buffer;
     char *name;
 
+    /* Decompression target, swapped with 'buffer' after each use so that
+     * neither is reallocated per message
+     */
+    char *scratch;
+    unsigned int scratch_size;
+
+    /* Codecs the server can decompress, as advertised in its last message */
+    uint8_t server_codecs;
+
     qb_ipcc_connection_t *ipc;
 
 };
@@ -953,6 +1361,7 @@ crm_ipc_destroy(crm_ipc_t * client)
         }
         crm_trace("Destroying IPC connection to %s: %p", client->name, client);
         free(client->buffer);
+        free(client->scratch);
         free(client->name);
         free(client);
     }
@@ -1025,24 +1434,33 @@ crm_ipc_decompress(crm_ipc_t * client)
 {
     struct crm_ipc_response_header *header = (struct crm_ipc_response_header *)(void*)client->buffer;
 
+    client->server_codecs = header->codecs;
+
     if (header->size_compressed) {
         int rc = 0;
         unsigned int size_u = 1 + header->size_uncompressed;
         /* never let buf size fall below our max size required for ipc reads. */
         unsigned int new_buf_size = QB_MAX((hdr_offset + size_u), client->max_buf_size);
-        char *uncompressed = calloc(1, new_buf_size);
+        char *uncompressed = NULL;
 
-        crm_trace("Decompressing message data %u bytes into %u bytes",
-                 header->size_compressed, size_u);
+        if (client->scratch_size < new_buf_size) {
+            free(client->scratch);
+            client->scratch = malloc(new_buf_size);
+            CRM_ASSERT(client->scratch != NULL);
+            client->scratch_size = new_buf_size;
+        }
+        uncompressed = client->scratch;
 
-        rc = BZ2_bzBuffToBuffDecompress(uncompressed + hdr_offset, &size_u,
-                                        client->buffer + hdr_offset, header->size_compressed, 1, 0);
+        crm_trace("Decompressing message data %u bytes into %u bytes with %s",
+                 header->size_compressed, size_u,
+                 pcmk__codec_text(header->codec));
 
-        if (rc != BZ_OK) {
-            crm_err("Decompression failed: %s " CRM_XS " bzerror=%d",
-                    bz2_strerror(rc), rc);
-            free(uncompressed);
-            return -EILSEQ;
+        rc = pcmk__decompress(header->codec, client->buffer + hdr_offset,
+                              header->size_compressed,
+                              uncompressed + hdr_offset, &size_u);
+
+        if (rc != pcmk_ok) {
+            return rc;
         }
 
         /*
@@ -1058,9 +1476,12 @@ crm_ipc_decompress(crm_ipc_t * client)
         memcpy(uncompressed, client->buffer, hdr_offset);       /* Preserve the header */
         header = (struct crm_ipc_response_header *)(void*)uncompressed;
 
-        free(client->buffer);
-        client->buf_size = new_buf_size;
+        /* The compressed copy is no longer needed, so reuse its buffer */
+        client->scratch = client->buffer;
         client->buffer = uncompressed;
+        new_buf_size = client->scratch_size;
+        client->scratch_size = client->buf_size;
+        client->buf_size = new_buf_size;
     }
 
     CRM_ASSERT(client->buffer[hdr_offset + header->size_uncompressed - 1] == 0);
@@ -1260,7 +1681,8 @@ crm_ipc_send(crm_ipc_t * client, xmlNode * message, enum crm_ipc_flags flags, in
 
     id++;
     CRM_LOG_ASSERT(id != 0); /* Crude wrap-around detection */
-    rc = crm_ipc_prepare(id, message, &iov, client->max_buf_size);
+    rc = pcmk__ipc_prepare(id, message, &iov, client->max_buf_size,
+                           client->server_codecs);
     if(rc < 0) {
         return rc;
     }
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
 
 #include <sys/wait.h>
 
@@ -46,6 +47,198 @@ struct trigger_s {
 
 };
 
+/*
+ * Dispatch time statistics (kept only if PCMK_mainloop_stats is enabled)
+ */
+
+#define MAINLOOP_STATS_BUCKETS 6
+
+/* Upper bounds (in microseconds) of all but the last histogram bucket */
+static const long long mainloop_stats_bounds[MAINLOOP_STATS_BUCKETS - 1] = {
+    100, 1000, 10000, 100000, 1000000
+};
+
+static const char *mainloop_stats_names[MAINLOOP_STATS_BUCKETS] = {
+    "lt-100us", "lt-1ms", "lt-10ms", "lt-100ms", "lt-1s", "ge-1s"
+};
+
+typedef struct mainloop_stats_s {
+    char *name;
+    unsigned long long dispatches;
+    unsigned long long total_us;
+    unsigned long long max_us;
+    unsigned long long buckets[MAINLOOP_STATS_BUCKETS];
+} mainloop_stats_t;
+
+static GHashTable *mainloop_stats = NULL;
+
+static gboolean
+mainloop_stats_enabled(void)
+{
+    static int enabled = -1;
+
+    if (enabled < 0) {
+        enabled = crm_is_true(daemon_option("mainloop_stats"));
+    }
+    return enabled;
+}
+
+static long long
+mainloop_now_us(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000LL) + (now.tv_nsec / 1000);
+#else
+    return time(NULL) * 1000000LL;
+#endif
+}
+
+static void
+mainloop_stats_free(gpointer data)
+{
+    mainloop_stats_t *stats = data;
+
+    free(stats->name);
+    free(stats);
+}
+
+/*!
+ * \internal
+ * \brief Find (or create) the dispatch statistics for a source name
+ *
+ * \param[in] name  Name of mainloop source (or kind of source)
+ *
+ * \return Statistics to update, or NULL if statistics are disabled
+ */
+static mainloop_stats_t *
+mainloop_stats_get(const char *name)
+{
+    mainloop_stats_t *stats = NULL;
+
+    if (!mainloop_stats_enabled()) {
+        return NULL;
+    }
+    if (mainloop_stats == NULL) {
+        mainloop_stats = g_hash_table_new_full(crm_str_hash, g_str_equal, NULL,
+                                               mainloop_stats_free);
+    }
+
+    stats = g_hash_table_lookup(mainloop_stats, name);
+    if (stats == NULL) {
+        stats = calloc(1, sizeof(mainloop_stats_t));
+        CRM_ASSERT(stats != NULL);
+        stats->name = strdup(name);
+        g_hash_table_insert(mainloop_stats, stats->name, stats);
+    }
+    return stats;
+}
+
+/*!
+ * \internal
+ * \brief Record how long a dispatch took
+ *
+ * \param[in,out] stats     Statistics to update (may be NULL)
+ * \param[in]     start_us  When the dispatch started
+ */
+static void
+mainloop_stats_add(mainloop_stats_t *stats, long long start_us)
+{
+    long long elapsed = 0;
+    int lpc = 0;
+
+    if (stats == NULL) {
+        return;
+    }
+
+    elapsed = QB_MAX(mainloop_now_us() - start_us, 0);
+    while ((lpc < (MAINLOOP_STATS_BUCKETS - 1))
+           && (elapsed >= mainloop_stats_bounds[lpc])) {
+        lpc++;
+    }
+    stats->buckets[lpc]++;
+    stats->dispatches++;
+    stats->total_us += elapsed;
+    stats->max_us = QB_MAX(stats->max_us, elapsed);
+}
+
+/*!
+ * \internal
+ * \brief Describe how long mainloop dispatches have taken
+ *
+ * \param[in,out] parent  XML to add description to
+ *
+ * \return Newly added XML child of \p parent (or NULL if statistics are
+ *         disabled)
+ */
+xmlNode *
+mainloop_stats_xml(xmlNode *parent)
+{
+    GHashTableIter iter;
+    mainloop_stats_t *stats = NULL;
+    xmlNode *xml = NULL;
+
+    if (!mainloop_stats_enabled()) {
+        return NULL;
+    }
+
+    xml = create_xml_node(parent, "mainloop");
+    crm_xml_add_int(xml, "budget", mainloop_dispatch_budget());
+    if (mainloop_stats == NULL) {
+        return xml;
+    }
+
+    g_hash_table_iter_init(&iter, mainloop_stats);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &stats)) {
+        xmlNode *source = create_xml_node(xml, "source");
+        char buffer[32];
+
+        crm_xml_add(source, XML_ATTR_UNAME, stats->name);
+        snprintf(buffer, sizeof(buffer), "%llu", stats->dispatches);
+        crm_xml_add(source, "dispatches", buffer);
+        snprintf(buffer, sizeof(buffer), "%llu", stats->total_us);
+        crm_xml_add(source, "total-us", buffer);
+        snprintf(buffer, sizeof(buffer), "%llu", stats->max_us);
+        crm_xml_add(source, "max-us", buffer);
+        for (int lpc = 0; lpc < MAINLOOP_STATS_BUCKETS; lpc++) {
+            snprintf(buffer, sizeof(buffer), "%llu", stats->buckets[lpc]);
+            crm_xml_add(source, mainloop_stats_names[lpc], buffer);
+        }
+    }
+    return xml;
+}
+
+/*!
+ * \internal
+ * \brief Get the most messages to read from one IPC connection per dispatch
+ *
+ * \return PCMK_mainloop_budget if valid, otherwise 10
+ * \note On the client side of an IPC connection, once the connection has used
+ *       its budget, it yields to other sources until the next mainloop
+ *       iteration. libqb decides how much to read from the connections of a
+ *       server's clients, so a client that delivers its budget in one
+ *       dispatch is instead dispatched after all other default-priority
+ *       sources until it delivers less.
+ */
+int
+mainloop_dispatch_budget(void)
+{
+    static int budget = 0;
+
+    if (budget == 0) {
+        const char *value = daemon_option("mainloop_budget");
+
+        budget = crm_parse_int(value, "10");
+        if (budget <= 0) {
+            crm_warn("Ignoring invalid PCMK_mainloop_budget '%s'", value);
+            budget = 10;
+        }
+    }
+    return budget;
+}
+
 static gboolean
 crm_trigger_prepare(GSource * source, gint * timeout)
 {
@@ -94,7 +287,10 @@ crm_trigger_dispatch(GSource * source, GSourceFunc callback, gpointer userdata)
     trig->trigger = FALSE;
 
     if (callback) {
+        long long start_us = mainloop_stats_enabled()? mainloop_now_us() : 0;
+
         rc = callback(trig->user_data);
+        mainloop_stats_add(mainloop_stats_get("trigger"), start_us);
         if (rc < 0) {
             crm_trace("Trigger handler %p not yet complete", trig);
             trig->running = TRUE;
@@ -403,6 +599,11 @@ mainloop_cleanup(void)
         qb_array_free(gio_map);
     }
 
+    if (mainloop_stats) {
+        g_hash_table_destroy(mainloop_stats);
+        mainloop_stats = NULL;
+    }
+
     for (int sig = 0; sig < NSIG; ++sig) {
         mainloop_destroy_signal_entry(sig);
     }
@@ -418,13 +619,21 @@ struct gio_to_qb_poll {
     void *data;
     qb_ipcs_dispatch_fn_t fn;
     enum qb_loop_priority p;
+    gboolean yielding;
 };
 
+static void gio_set_yielding(struct gio_to_qb_poll *adaptor, gboolean yielding);
+
 static gboolean
 gio_read_socket(GIOChannel * gio, GIOCondition condition, gpointer data)
 {
     struct gio_to_qb_poll *adaptor = (struct gio_to_qb_poll *)data;
     gint fd = g_io_channel_unix_get_fd(gio);
+    long long start_us = mainloop_stats_enabled()? mainloop_now_us() : 0;
+    void *conn = adaptor->data;
+    crm_client_t *client = crm_client_get(conn);
+    uint64_t requests = client? client->stats.requests : 0;
+    int32_t rc = 0;
 
     crm_trace("%p.%d %d", data, fd, condition);
 
@@ -432,7 +641,20 @@ gio_read_socket(GIOChannel * gio, GIOCondition condition, gpointer data)
      * when we destroy a fd and when mainloop actually gives it up */
     CRM_ASSERT(adaptor->is_used > 0);
 
-    return (adaptor->fn(fd, condition, adaptor->data) == 0);
+    rc = adaptor->fn(fd, condition, conn);
+    mainloop_stats_add(mainloop_stats_get("ipc-server"), start_us);
+
+    /* libqb reads every queued request (up to its own limit) in one dispatch,
+     * so a client flooding a server would otherwise hold up timers and
+     * cluster messaging every iteration. The client may have disconnected
+     * during the dispatch, so look it up again.
+     */
+    if ((rc == 0) && (client != NULL) && (crm_client_get(conn) == client)) {
+        requests = client->stats.requests - requests;
+        gio_set_yielding(adaptor,
+                         (requests >= (uint64_t) mainloop_dispatch_budget()));
+    }
+    return (rc == 0);
 }
 
 static void
@@ -449,6 +671,58 @@ gio_poll_destroy(gpointer data)
     }
 }
 
+/*!
+ * \internal
+ * \brief Map a libqb loop priority to a glib one
+ *
+ * libqb lowers the priority of IPC connections when a server asks it to
+ * rate-limit them, so honor that relative to our other sources (which mostly
+ * use G_PRIORITY_DEFAULT) rather than dispatching every connection alike.
+ */
+static gint
+gio_priority(enum qb_loop_priority p)
+{
+    switch (p) {
+        case QB_LOOP_HIGH:
+            return G_PRIORITY_DEFAULT - 10;
+        case QB_LOOP_LOW:
+            return G_PRIORITY_DEFAULT + 10;
+        default:
+            return G_PRIORITY_DEFAULT;
+    }
+}
+
+/*!
+ * \internal
+ * \brief Make a server's client connection yield to other sources, or not
+ *
+ * \param[in,out] adaptor   Client connection's adaptor
+ * \param[in]     yielding  Whether the connection has used its dispatch budget
+ */
+static void
+gio_set_yielding(struct gio_to_qb_poll *adaptor, gboolean yielding)
+{
+    GSource *source = NULL;
+
+    if ((adaptor->yielding == yielding) || (adaptor->source == 0)) {
+        return;
+    }
+    source = g_main_context_find_source_by_id(NULL, adaptor->source);
+    if (source == NULL) {
+        return;
+    }
+
+    adaptor->yielding = yielding;
+    if (yielding) {
+        g_source_set_priority(source,
+                              MAX(gio_priority(adaptor->p), G_PRIORITY_DEFAULT) + 1);
+    } else {
+        g_source_set_priority(source, gio_priority(adaptor->p));
+    }
+    crm_trace("IPC connection for adaptor %p %s", adaptor,
+              (yielding? "used its budget, yielding" : "no longer yielding"));
+}
+
 static int32_t
 gio_poll_dispatch_update(enum qb_loop_priority p, int32_t fd, int32_t evts,
                          void *data, qb_ipcs_dispatch_fn_t fn, int32_t add)
@@ -493,10 +767,11 @@ gio_poll_dispatch_update(enum qb_loop_priority p, int32_t fd, int32_t evts,
     adaptor->events = evts;
     adaptor->data = data;
     adaptor->p = p;
+    adaptor->yielding = FALSE;
     adaptor->is_used++;
     adaptor->source =
-        g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, evts, gio_read_socket, adaptor,
-                            gio_poll_destroy);
+        g_io_add_watch_full(channel, gio_priority(p), evts, gio_read_socket,
+                            adaptor, gio_poll_destroy);
 
     /* Now that mainloop now holds a reference to channel,
      * thanks to g_io_add_watch_full(), drop ours from g_io_channel_unix_new().
@@ -629,6 +904,7 @@ struct mainloop_io_s {
     int (*dispatch_fn_io) (gpointer userdata);
     void (*destroy_fn) (gpointer userdata);
 
+    mainloop_stats_t *stats;    /* Dispatch times, if being kept */
 };
 
 static gboolean
@@ -636,13 +912,14 @@ mainloop_gio_callback(GIOChannel * gio, GIOCondition condition, gpointer data)
 {
     gboolean keep = TRUE;
     mainloop_io_t *client = data;
+    long long start_us = client->stats? mainloop_now_us() : 0;
 
     CRM_ASSERT(client->fd == g_io_channel_unix_get_fd(gio));
 
     if (condition & G_IO_IN) {
         if (client->ipc) {
             long rc = 0;
-            int max = 10;
+            int max = mainloop_dispatch_budget();
 
             do {
                 rc = crm_ipc_read(client->ipc);
@@ -714,6 +991,8 @@ mainloop_gio_callback(GIOChannel * gio, GIOCondition condition, gpointer data)
         crm_err("Strange condition: %d", condition);
     }
 
+    mainloop_stats_add(client->stats, start_us);
+
     /* keep == FALSE results in mainloop_gio_destroy() being called
      * just before the source is removed from mainloop
      */
@@ -813,6 +1092,7 @@ mainloop_add_fd(const char *name, int priority, int fd, void *userdata,
         }
         client->name = strdup(name);
         client->userdata = userdata;
+        client->stats = mainloop_stats_get(name);
 
         if (callbacks) {
             client->destroy_fn = callbacks->destroy;
@@ -1000,6 +1280,7 @@ child_death_dispatch(int signal)
 {
     GListPtr iter = child_list;
     gboolean exited;
+    long long start_us = mainloop_stats_enabled()? mainloop_now_us() : 0;
 
     while(iter) {
         GListPtr saved = NULL;
@@ -1018,6 +1299,7 @@ child_death_dispatch(int signal)
         g_list_free(saved);
         child_free(child);
     }
+    mainloop_stats_add(mainloop_stats_get("child-exit"), start_us);
 }
 
 static gboolean
@@ -14,6 +14,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -24,8 +25,6 @@
 #include <errno.h>
 #include <glib.h>
 
-#include <bzlib.h>
-
 #include <crm/common/ipcs.h>
 #include <crm/common/xml.h>
 #include <crm/common/mainloop.h>
@@ -80,6 +79,21 @@ const int anon_tls_kx_order[] = {
 #define REMOTE_MSG_VERSION 1
 #define ENDIAN_LOCAL 0xBADADBBD
 
+/* The low byte of a header's flags holds the codec used for a compressed
+ * payload (0 is bzip2, which is all that peers predating this understand)
+ */
+#define REMOTE_FLAG_CODEC_MASK 0xFFULL
+
+/* Compress payloads at least this big by default, once the peer has said
+ * which codecs it can decompress
+ */
+#define REMOTE_COMPRESS_THRESHOLD_DEFAULT 4096
+
+/* Messages up to this size (the most a single TLS record can hold) are
+ * packed into one buffer so they go out as one record
+ */
+#define REMOTE_TLS_PACK_MAX 16384
+
 struct crm_remote_header_v0 
 {
     uint32_t endian;    /* Detect messages from hosts with different endian-ness */
@@ -248,50 +262,69 @@ crm_send_tls(gnutls_session_t * session, const char *buf, size_t len)
 }
 #endif
 
+/*!
+ * \internal
+ * \brief Write a vector of buffers to a socket
+ *
+ * \param[in] sock  Socket to write to
+ * \param[in] iov   Buffers to write
+ * \param[in] iovs  Number of entries in \p iov
+ *
+ * \return Number of bytes written on success, -errno otherwise
+ * \note This retries partial writes, so each message takes a single system
+ *       call in the usual case, instead of one per buffer.
+ */
 static int
-crm_send_plaintext(int sock, const char *buf, size_t len)
+crm_send_plaintext(int sock, struct iovec *iov, int iovs)
 {
-
     int rc = 0;
-    const char *unsent = buf;
-    int total_send;
+    int lpc = 0;
+    size_t offset = 0;  /* Bytes of iov[lpc] already written */
+    size_t total_send = 0;
 
-    if (buf == NULL) {
-        return -EINVAL;
+    for (int i = 0; i < iovs; i++) {
+        if (iov[i].iov_base == NULL) {
+            return -EINVAL;
+        }
+        total_send += iov[i].iov_len;
     }
-    total_send = len;
 
-    crm_trace("Message on socket %d: size=%llu",
-              sock, (unsigned long long) len);
-  retry:
-    rc = write(sock, unsent, len);
-    if (rc < 0) {
-        rc = -errno;
-        switch (errno) {
-            case EINTR:
-            case EAGAIN:
+    crm_trace("Message on socket %d: size=%llu in %d parts",
+              sock, (unsigned long long) total_send, iovs);
+
+    while (lpc < iovs) {
+        struct iovec remaining[iovs - lpc];
+
+        /* writev() can't take an offset, so point past what has been sent */
+        memcpy(remaining, iov + lpc, sizeof(remaining));
+        remaining[0].iov_base = (char *) remaining[0].iov_base + offset;
+        remaining[0].iov_len -= offset;
+
+        rc = writev(sock, remaining, iovs - lpc);
+        if (rc < 0) {
+            rc = -errno;
+            if ((errno == EINTR) || (errno == EAGAIN)) {
                 crm_trace("Retry");
-                goto retry;
-            default:
-                crm_perror(LOG_INFO,
-                           "Could only write %d of the remaining %llu bytes",
-                           rc, (unsigned long long) len);
-                break;
+                continue;
+            }
+            crm_perror(LOG_INFO, "Could not write %llu-byte message",
+                       (unsigned long long) total_send);
+            return rc;
         }
 
-    } else if (rc < len) {
-        crm_trace("Only sent %d of %llu remaining bytes",
-                  rc, (unsigned long long) len);
-        len -= rc;
-        unsent += rc;
-        goto retry;
-
-    } else {
-        crm_trace("Sent %d bytes: %.100s", rc, buf);
+        /* Skip past whatever was written */
+        offset += rc;
+        while ((lpc < iovs) && (offset >= iov[lpc].iov_len)) {
+            offset -= iov[lpc].iov_len;
+            lpc++;
+        }
+        if (lpc < iovs) {
+            crm_trace("Only sent %d bytes, retrying for the rest", rc);
+        }
     }
 
-    return rc < 0 ? rc : total_send;
-
+    crm_trace("Sent %llu bytes", (unsigned long long) total_send);
+    return total_send;
 }
 
 static int
@@ -299,43 +332,148 @@ crm_remote_sendv(crm_remote_t * remote, struct iovec * iov, int iovs)
 {
     int rc = 0;
 
-    for (int lpc = 0; (lpc < iovs) && (rc >= 0); lpc++) {
 #ifdef HAVE_GNUTLS_GNUTLS_H
-        if (remote->tls_session) {
+    if (remote->tls_session) {
+        static char *packed = NULL;
+        size_t total = 0;
+
+        for (int lpc = 0; lpc < iovs; lpc++) {
+            total += iov[lpc].iov_len;
+        }
+
+        if (total <= REMOTE_TLS_PACK_MAX) {
+            /* Copy small messages into one buffer, so the header doesn't get
+             * a TLS record (and encryption and system call) all its own
+             */
+            size_t offset = 0;
+
+            if (packed == NULL) {
+                packed = malloc(REMOTE_TLS_PACK_MAX);
+                CRM_ASSERT(packed != NULL);
+            }
+            for (int lpc = 0; lpc < iovs; lpc++) {
+                memcpy(packed + offset, iov[lpc].iov_base, iov[lpc].iov_len);
+                offset += iov[lpc].iov_len;
+            }
+            return crm_send_tls(remote->tls_session, packed, total);
+        }
+
+        for (int lpc = 0; (lpc < iovs) && (rc >= 0); lpc++) {
             rc = crm_send_tls(remote->tls_session, iov[lpc].iov_base, iov[lpc].iov_len);
-            continue;
         }
+        return rc;
+    }
 #endif
-        if (remote->tcp_socket) {
-            rc = crm_send_plaintext(remote->tcp_socket, iov[lpc].iov_base, iov[lpc].iov_len);
-        } else {
-            rc = -ESOCKTNOSUPPORT;
-        }
+
+    if (remote->tcp_socket) {
+        rc = crm_send_plaintext(remote->tcp_socket, iov, iovs);
+    } else {
+        rc = -ESOCKTNOSUPPORT;
     }
     return rc;
 }
 
+/*!
+ * \internal
+ * \brief Get the smallest payload that should be compressed
+ *
+ * \return PCMK_remote_compress_threshold if set, otherwise a default
+ *         (compression is disabled if this is 0)
+ */
+static unsigned int
+remote_compress_threshold(void)
+{
+    static int threshold = -1;
+
+    if (threshold < 0) {
+        const char *value = daemon_option("remote_compress_threshold");
+
+        threshold = REMOTE_COMPRESS_THRESHOLD_DEFAULT;
+        if (value != NULL) {
+            long long parsed = crm_int_helper(value, NULL);
+
+            if ((errno != 0) || (parsed < 0) || (parsed > INT_MAX)) {
+                crm_warn("Ignoring invalid PCMK_remote_compress_threshold '%s'",
+                         value);
+            } else {
+                threshold = (int) parsed;
+            }
+        }
+    }
+    return (unsigned int) threshold;
+}
+
+/*!
+ * \internal
+ * \brief Advertise the payload codecs we can decompress in a handshake
+ *
+ * \param[in,out] msg  Sign-on request or its reply
+ */
+void
+crm_remote_add_codecs(xmlNode *msg)
+{
+    crm_xml_add_int(msg, F_REMOTE_CODECS, pcmk__codecs_supported());
+}
+
+/*!
+ * \internal
+ * \brief Remember which payload codecs a peer advertised in a handshake
+ *
+ * Until this is called, payloads sent on the connection are never
+ * compressed, since an older peer might not expect it.
+ *
+ * \param[in,out] remote  Connection to peer
+ * \param[in]     msg     Sign-on request or its reply from peer
+ */
+void
+crm_remote_set_codecs(crm_remote_t *remote, xmlNode *msg)
+{
+    int codecs = 0;
+
+    if ((remote != NULL)
+        && (crm_element_value_int(msg, F_REMOTE_CODECS, &codecs) == 0)) {
+        remote->codecs = (uint8_t) codecs;
+        crm_trace("Remote peer can decompress %s payloads (codecs 0x%.2x)",
+                  pcmk__codec_text(pcmk__codec_choose(remote->codecs)),
+                  remote->codecs);
+    }
+}
+
+/*!
+ * \internal
+ * \brief Send an already serialized message to a remote connection
+ *
+ * \param[in] remote  Connection to send to
+ * \param[in] text    Serialized XML message
+ * \param[in] len     Length of \p text, including its terminator
+ *
+ * \return pcmk_ok on success, -errno otherwise
+ * \note This lets one serialization be sent to many clients.
+ */
 int
-crm_remote_send(crm_remote_t * remote, xmlNode * msg)
+crm_remote_send_text(crm_remote_t *remote, const char *text, size_t len)
 {
     int rc = pcmk_ok;
     static uint64_t id = 0;
-    char *xml_text = dump_xml_unformatted(msg);
 
     struct iovec iov[2];
-    struct crm_remote_header_v0 *header;
+    struct crm_remote_header_v0 header_local;
+    struct crm_remote_header_v0 *header = &header_local;
+    char *compressed = NULL;
+    unsigned int compressed_len = 0;
+    unsigned int threshold = remote_compress_threshold();
 
-    if (xml_text == NULL) {
+    if (text == NULL) {
         crm_err("Could not send remote message: no message provided");
         return -EINVAL;
     }
 
-    header = calloc(1, sizeof(struct crm_remote_header_v0));
+    memset(header, 0, sizeof(struct crm_remote_header_v0));
     iov[0].iov_base = header;
     iov[0].iov_len = sizeof(struct crm_remote_header_v0);
 
-    iov[1].iov_base = xml_text;
-    iov[1].iov_len = 1 + strlen(xml_text);
+    iov[1].iov_base = (char *) text;
+    iov[1].iov_len = len;
 
     id++;
     header->id = id;
@@ -343,18 +481,50 @@ crm_remote_send(crm_remote_t * remote, xmlNode * msg)
     header->version = REMOTE_MSG_VERSION;
     header->payload_offset = iov[0].iov_len;
     header->payload_uncompressed = iov[1].iov_len;
+
+    if (remote->codecs && threshold && (len >= threshold)) {
+        enum pcmk__codec codec = pcmk__codec_choose(remote->codecs);
+
+        if (pcmk__compress(codec, text, len, 0, &compressed, &compressed_len)
+            && (compressed_len >= len)) {
+            // Not worth it; send it as is
+            free(compressed);
+            compressed = NULL;
+
+        } else if (compressed != NULL) {
+            iov[1].iov_base = compressed;
+            iov[1].iov_len = compressed_len;
+            header->payload_compressed = compressed_len;
+            header->flags |= (codec & REMOTE_FLAG_CODEC_MASK);
+        }
+    }
     header->size_total = iov[0].iov_len + iov[1].iov_len;
 
     crm_trace("Sending len[0]=%d, start=%x",
-              (int)iov[0].iov_len, *(int*)(void*)xml_text);
+              (int)iov[0].iov_len, *(int*)(void*)text);
     rc = crm_remote_sendv(remote, iov, 2);
     if (rc < 0) {
         crm_err("Could not send remote message: %s " CRM_XS " rc=%d",
                 pcmk_strerror(rc), rc);
     }
 
-    free(iov[0].iov_base);
-    free(iov[1].iov_base);
+    free(compressed);
+    return rc;
+}
+
+int
+crm_remote_send(crm_remote_t * remote, xmlNode * msg)
+{
+    int rc = pcmk_ok;
+    char *xml_text = dump_xml_unformatted(msg);
+
+    if (xml_text == NULL) {
+        crm_err("Could not send remote message: no message provided");
+        return -EINVAL;
+    }
+
+    rc = crm_remote_send_text(remote, xml_text, 1 + strlen(xml_text));
+    free(xml_text);
     return rc;
 }
 
@@ -374,28 +544,28 @@ crm_remote_parse_buffer(crm_remote_t * remote)
         return NULL;
     }
 
-    /* Support compression on the receiving end now, in case we ever want to add it later */
     if (header->payload_compressed) {
         int rc = 0;
         unsigned int size_u = 1 + header->payload_uncompressed;
         char *uncompressed = calloc(1, header->payload_offset + size_u);
+        enum pcmk__codec codec = header->flags & REMOTE_FLAG_CODEC_MASK;
 
-        crm_trace("Decompressing message data %d bytes into %d bytes",
-                 header->payload_compressed, size_u);
+        crm_trace("Decompressing message data %d bytes into %d bytes with %s",
+                 header->payload_compressed, size_u, pcmk__codec_text(codec));
 
-        rc = BZ2_bzBuffToBuffDecompress(uncompressed + header->payload_offset, &size_u,
-                                        remote->buffer + header->payload_offset,
-                                        header->payload_compressed, 1, 0);
+        rc = pcmk__decompress(codec, remote->buffer + header->payload_offset,
+                              header->payload_compressed,
+                              uncompressed + header->payload_offset, &size_u);
 
-        if (rc != BZ_OK && header->version > REMOTE_MSG_VERSION) {
+        if (rc != pcmk_ok && header->version > REMOTE_MSG_VERSION) {
             crm_warn("Couldn't decompress v%d message, we only understand v%d",
                      header->version, REMOTE_MSG_VERSION);
             free(uncompressed);
             return NULL;
 
-        } else if (rc != BZ_OK) {
-            crm_err("Decompression failed: %s " CRM_XS " bzerror=%d",
-                    bz2_strerror(rc), rc);
+        } else if (rc != pcmk_ok) {
+            crm_err("Decompression of %s payload failed: %s " CRM_XS " rc=%d",
+                    pcmk__codec_text(codec), pcmk_strerror(rc), rc);
             free(uncompressed);
             return NULL;
         }
@@ -44,6 +44,15 @@ typedef struct {
     xmlRelaxNGParserCtxtPtr parser;
 } relaxng_ctx_cache_t;
 
+#if HAVE_LIBXSLT
+/* Parsed upgrade stylesheets, loaded on first use */
+typedef struct {
+    xsltStylesheetPtr enter;
+    xsltStylesheetPtr upgrade;
+    xsltStylesheetPtr leave;
+} xslt_cache_t;
+#endif
+
 enum schema_validator_e {
     schema_validator_none,
     schema_validator_rng
@@ -59,12 +68,25 @@ struct schema_s {
     schema_version_t version;
     char *transform_enter;
     bool transform_onleave;
+    void *transform_cache;
 };
 
 static struct schema_s *known_schemas = NULL;
 static int xml_schema_max = 0;
 static bool silent_logging = FALSE;
 
+/* The last upgrade done for a trusted configuration, so that the same
+ * configuration can be upgraded again without re-validating every step
+ */
+static struct {
+    uint64_t key;
+    int version;
+    int *steps;
+    int n_steps;
+} last_trusted_upgrade = { 0, -1, NULL, 0 };
+
+static void free_known_schemas(void);
+
 static void
 xml_log(int priority, const char *fmt, ...)
 G_GNUC_PRINTF(2, 3);
@@ -367,6 +389,9 @@ crm_schema_init(void)
     struct dirent **namelist = NULL;
     const schema_version_t zero = SCHEMA_ZERO;
 
+    /* Anything cached for a previous load may be out of date */
+    free_known_schemas();
+
     max = scandir(base, &namelist, schema_filter, schema_sort);
     if (max < 0) {
         crm_notice("scandir(%s) failed: %s (%d)", base, strerror(errno), errno);
@@ -527,12 +552,36 @@ validate_with_relaxng(xmlDocPtr doc, gboolean to_logs, const char *relaxng_file,
     return valid;
 }
 
+#if HAVE_LIBXSLT
+static void
+free_transform_cache(struct schema_s *schema)
+{
+    xslt_cache_t *cache = schema->transform_cache;
+
+    if (cache == NULL) {
+        return;
+    }
+    if (cache->enter != NULL) {
+        xsltFreeStylesheet(cache->enter);
+    }
+    if (cache->upgrade != NULL) {
+        xsltFreeStylesheet(cache->upgrade);
+    }
+    if (cache->leave != NULL) {
+        xsltFreeStylesheet(cache->leave);
+    }
+    free(cache);
+    schema->transform_cache = NULL;
+}
+#endif
+
 /*!
  * \internal
- * \brief Clean up global memory associated with XML schemas
+ * \brief Free the known schemas, along with their cached validators and
+ *        stylesheets
  */
-void
-crm_schema_cleanup(void)
+static void
+free_known_schemas(void)
 {
     int lpc;
     relaxng_ctx_cache_t *ctx = NULL;
@@ -560,6 +609,9 @@ crm_schema_cleanup(void)
                 known_schemas[lpc].cache = NULL;
                 break;
         }
+#if HAVE_LIBXSLT
+        free_transform_cache(&known_schemas[lpc]);
+#endif
         free(known_schemas[lpc].name);
         free(known_schemas[lpc].location);
         free(known_schemas[lpc].transform);
@@ -567,7 +619,23 @@ crm_schema_cleanup(void)
     }
     free(known_schemas);
     known_schemas = NULL;
+    xml_schema_max = 0;
+
+    /* Schema indexes may mean something else after a reload */
+    free(last_trusted_upgrade.steps);
+    last_trusted_upgrade.steps = NULL;
+    last_trusted_upgrade.n_steps = 0;
+    last_trusted_upgrade.version = -1;
+}
 
+/*!
+ * \internal
+ * \brief Clean up global memory associated with XML schemas
+ */
+void
+crm_schema_cleanup(void)
+{
+    free_known_schemas();
     xsltCleanupGlobals();  /* XXX proper, explicit reshaking regarding
                                   init/fini routines is pending (pair
                                   of facade functions to express the
@@ -883,8 +951,20 @@ cib_upgrade_err(void *ctx, const char *fmt, ...)
 #define PCMK_SCHEMAS_EMERGENCY_XSLT 1
 #endif
 
+/*!
+ * \internal
+ * \brief Transform XML with a stylesheet, parsing it only the first time
+ *
+ * \param[in]     xml        XML to transform
+ * \param[in]     transform  Stylesheet file name (relative to schema root)
+ * \param[in,out] cached     Where the parsed stylesheet is (or will be) kept
+ * \param[in]     to_logs    Whether to log stylesheet messages or print them
+ *
+ * \return Transformed XML on success, NULL otherwise
+ */
 static xmlNode *
-apply_transformation(xmlNode *xml, const char *transform, gboolean to_logs)
+apply_transformation(xmlNode *xml, const char *transform,
+                     xsltStylesheetPtr *cached, gboolean to_logs)
 {
     char *xform = NULL;
     xmlNode *out = NULL;
@@ -911,7 +991,11 @@ apply_transformation(xmlNode *xml, const char *transform, gboolean to_logs)
         xsltSetGenericErrorFunc(&crm_log_level, cib_upgrade_err);
     }
 
-    xslt = xsltParseStylesheetFile((const xmlChar *)xform);
+    if (*cached == NULL) {
+        crm_trace("Parsing stylesheet %s", xform);
+        *cached = xsltParseStylesheetFile((const xmlChar *)xform);
+    }
+    xslt = *cached;
     CRM_CHECK(xslt != NULL, goto cleanup);
 
     res = xsltApplyStylesheet(xslt, doc, NULL);
@@ -932,10 +1016,6 @@ apply_transformation(xmlNode *xml, const char *transform, gboolean to_logs)
 #endif
 
   cleanup:
-    if (xslt) {
-        xsltFreeStylesheet(xslt);
-    }
-
     free(xform);
 
     return out;
@@ -948,17 +1028,25 @@ apply_transformation(xmlNode *xml, const char *transform, gboolean to_logs)
  * \note Only emits warnings about enter/leave phases in case of issues.
  */
 static xmlNode *
-apply_upgrade(xmlNode *xml, const struct schema_s *schema, gboolean to_logs)
+apply_upgrade(xmlNode *xml, struct schema_s *schema, gboolean to_logs)
 {
     bool transform_onleave = schema->transform_onleave;
     char *transform_leave;
     xmlNode *upgrade = NULL,
             *final = NULL;
+    xslt_cache_t *cache = schema->transform_cache;
+
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(xslt_cache_t));
+        CRM_ASSERT(cache != NULL);
+        schema->transform_cache = cache;
+    }
 
     if (schema->transform_enter) {
         crm_debug("Upgrading %s-style configuration, pre-upgrade phase with %s",
                   schema->name, schema->transform_enter);
-        upgrade = apply_transformation(xml, schema->transform_enter, to_logs);
+        upgrade = apply_transformation(xml, schema->transform_enter,
+                                       &cache->enter, to_logs);
         if (upgrade == NULL) {
             crm_warn("Upgrade-enter transformation %s failed",
                      schema->transform_enter);
@@ -971,7 +1059,8 @@ apply_upgrade(xmlNode *xml, const struct schema_s *schema, gboolean to_logs)
 
     crm_debug("Upgrading %s-style configuration, main phase with %s",
               schema->name, schema->transform);
-    final = apply_transformation(upgrade, schema->transform, to_logs);
+    final = apply_transformation(upgrade, schema->transform,
+                                 &cache->upgrade, to_logs);
 
     if (final != NULL && transform_onleave) {
         free_xml(upgrade);
@@ -981,7 +1070,8 @@ apply_upgrade(xmlNode *xml, const struct schema_s *schema, gboolean to_logs)
         memcpy(strrchr(transform_leave, '-') + 1, "leave", 5);
         crm_debug("Upgrading %s-style configuration, post-upgrade phase with %s",
                   schema->name, transform_leave);
-        final = apply_transformation(upgrade, transform_leave, to_logs);
+        final = apply_transformation(upgrade, transform_leave,
+                                     &cache->leave, to_logs);
         if (final == NULL) {
             crm_warn("Upgrade-leave transformation %s failed", transform_leave);
             final = upgrade;
@@ -1021,10 +1111,26 @@ get_schema_version(const char *name)
     return -1;
 }
 
-/* set which validation to use */
-int
-update_validation(xmlNode **xml_blob, int *best, int max, gboolean transform,
-                  gboolean to_logs)
+/*!
+ * \internal
+ * \brief Update the schema used by XML, optionally recording transforms
+ *
+ * \param[in,out] xml_blob   XML to update (may be replaced)
+ * \param[out]    best       Index of the newest schema the result validates with
+ * \param[in]     max        Newest schema index to consider (0 for any)
+ * \param[in]     transform  Whether to transform the XML when necessary
+ * \param[in]     to_logs    Whether to log messages or print them
+ * \param[out]    steps      If not NULL, where to record the index of each
+ *                           schema whose upgrade transform was applied
+ *                           (must have room for xml_schema_max entries)
+ * \param[out]    n_steps    If \p steps is not NULL, number of entries stored
+ *
+ * \return pcmk_ok on success, or a negative error code otherwise
+ */
+static int
+update_validation_steps(xmlNode **xml_blob, int *best, int max,
+                        gboolean transform, gboolean to_logs,
+                        int *steps, int *n_steps)
 {
     xmlNode *xml = NULL;
     char *value = NULL;
@@ -1034,6 +1140,9 @@ update_validation(xmlNode **xml_blob, int *best, int max, gboolean transform,
 
     CRM_CHECK(best != NULL, return -EINVAL);
     *best = 0;
+    if (steps != NULL) {
+        *n_steps = 0;
+    }
 
     CRM_CHECK(xml_blob != NULL, return -EINVAL);
     CRM_CHECK(*xml_blob != NULL, return -EINVAL);
@@ -1136,6 +1245,9 @@ update_validation(xmlNode **xml_blob, int *best, int max, gboolean transform,
                 } else if (validate_with(upgrade, next, to_logs)) {
                     crm_info("Transformation %s successful",
                              known_schemas[lpc].transform);
+                    if (steps != NULL) {
+                        steps[(*n_steps)++] = lpc;
+                    }
                     lpc = next;
                     *best = next;
                     free_xml(xml);
@@ -1171,8 +1283,125 @@ update_validation(xmlNode **xml_blob, int *best, int max, gboolean transform,
     return rc;
 }
 
-gboolean
-cli_config_update(xmlNode **xml, int *best_version, gboolean to_logs)
+/* set which validation to use */
+int
+update_validation(xmlNode **xml_blob, int *best, int max, gboolean transform,
+                  gboolean to_logs)
+{
+    return update_validation_steps(xml_blob, best, max, transform, to_logs,
+                                   NULL, NULL);
+}
+
+/*!
+ * \internal
+ * \brief Calculate a key that changes when a CIB's validity might
+ *
+ * \param[in] xml  CIB to check
+ *
+ * \return Key based on validate-with and all top-level sections but status
+ * \note The status section's schema accepts anything, and the CIB manager
+ *       ensures the CIB's own attributes are valid, so they are left out to
+ *       let the key survive status updates.
+ */
+static uint64_t
+trusted_upgrade_key(xmlNode *xml)
+{
+    xmlNode *child = NULL;
+    uint64_t key = 14695981039346656037ULL; /* FNV-1a */
+    const char *validate_with = crm_element_value(xml, XML_ATTR_VALIDATION);
+
+    for (; validate_with && *validate_with; validate_with++) {
+        key = (key ^ (unsigned char) *validate_with) * 1099511628211ULL;
+    }
+    for (child = __xml_first_child_element(xml); child != NULL;
+         child = __xml_next_element(child)) {
+        if (safe_str_neq((const char *) child->name, XML_CIB_TAG_STATUS)) {
+            key = (key ^ crm_xml_hash(child)) * 1099511628211ULL;
+        }
+    }
+    return key;
+}
+
+/*!
+ * \internal
+ * \brief Apply previously recorded upgrade transforms without validation
+ *
+ * \param[in,out] xml      XML to upgrade (replaced on success)
+ * \param[out]    version  Where to store the resulting schema index
+ * \param[in]     to_logs  Whether to log messages or print them
+ *
+ * \return TRUE if all transforms succeeded, FALSE otherwise
+ */
+static gboolean
+replay_trusted_upgrade(xmlNode **xml, int *version, gboolean to_logs)
+{
+#if HAVE_LIBXSLT
+    int lpc = 0;
+    xmlNode *upgraded = *xml;
+
+    for (lpc = 0; lpc < last_trusted_upgrade.n_steps; lpc++) {
+        struct schema_s *schema = &known_schemas[last_trusted_upgrade.steps[lpc]];
+        xmlNode *next = apply_upgrade(upgraded, schema, to_logs);
+
+        if (next == NULL) {
+            if (upgraded != *xml) {
+                free_xml(upgraded);
+            }
+            return FALSE;
+        }
+        if (upgraded != *xml) {
+            free_xml(upgraded);
+        }
+        upgraded = next;
+    }
+
+    if (upgraded != *xml) {
+        free_xml(*xml);
+        *xml = upgraded;
+    }
+    crm_xml_add(*xml, XML_ATTR_VALIDATION,
+                known_schemas[last_trusted_upgrade.version].name);
+    *version = last_trusted_upgrade.version;
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+static void
+upgrade_config(xmlNode **xml, int *version, gboolean to_logs, gboolean trusted)
+{
+    uint64_t key = 0;
+
+    if (trusted == FALSE) {
+        update_validation(xml, version, 0, TRUE, to_logs);
+        return;
+    }
+
+    key = trusted_upgrade_key(*xml);
+    if ((last_trusted_upgrade.version >= 0)
+        && (key == last_trusted_upgrade.key)
+        && replay_trusted_upgrade(xml, version, to_logs)) {
+        crm_debug("Upgraded unchanged configuration to %s without validation",
+                  get_schema_name(*version));
+        return;
+    }
+
+    last_trusted_upgrade.version = -1;
+    last_trusted_upgrade.steps = realloc_safe(last_trusted_upgrade.steps,
+                                              xml_schema_max * sizeof(int));
+    if (update_validation_steps(xml, version, 0, TRUE, to_logs,
+                                last_trusted_upgrade.steps,
+                                &last_trusted_upgrade.n_steps) == pcmk_ok
+        && (*version >= xml_minimum_schema_index())) {
+        last_trusted_upgrade.key = key;
+        last_trusted_upgrade.version = *version;
+    }
+}
+
+static gboolean
+config_update(xmlNode **xml, int *best_version, gboolean to_logs,
+              gboolean trusted)
 {
     gboolean rc = TRUE;
     const char *value = crm_element_value(*xml, XML_ATTR_VALIDATION);
@@ -1186,7 +1415,7 @@ cli_config_update(xmlNode **xml, int *best_version, gboolean to_logs)
         xmlNode *converted = NULL;
 
         converted = copy_xml(*xml);
-        update_validation(&converted, &version, 0, TRUE, to_logs);
+        upgrade_config(&converted, &version, to_logs, trusted);
 
         value = crm_element_value(converted, XML_ATTR_VALIDATION);
         if (version < min_version) {
@@ -1255,3 +1484,31 @@ cli_config_update(xmlNode **xml, int *best_version, gboolean to_logs)
     free(orig_value);
     return rc;
 }
+
+gboolean
+cli_config_update(xmlNode **xml, int *best_version, gboolean to_logs)
+{
+    return config_update(xml, best_version, to_logs, FALSE);
+}
+
+/*!
+ * \internal
+ * \brief Upgrade a CIB obtained from the CIB manager, if needed
+ *
+ * This is like cli_config_update(), except that the CIB is trusted to be
+ * valid for the schema it names, as the CIB manager validates every change.
+ * A configuration that is already at least at the minimum supported schema
+ * is used as-is.  If an older one has not changed since it was last upgraded,
+ * the same transforms are applied again without validating each step.
+ *
+ * \param[in,out] xml           CIB to upgrade (may be replaced)
+ * \param[out]    best_version  If not NULL, where to store the schema index
+ * \param[in]     to_logs       Whether to log messages or print them
+ *
+ * \return TRUE if the CIB is usable, FALSE otherwise
+ */
+gboolean
+crm_config_update_trusted(xmlNode **xml, int *best_version, gboolean to_logs)
+{
+    return config_update(xml, best_version, to_logs, TRUE);
+}
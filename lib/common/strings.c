@@ -15,6 +15,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <bzlib.h>
+#if HAVE_LZ4
+#  include <lz4.h>
+#endif
 #include <sys/types.h>
 
 char *
@@ -389,12 +392,76 @@ add_list_element(char *list, const char *value)
     return list;
 }
 
+/*!
+ * \internal
+ * \brief Get the IPC payload codecs this build can compress and decompress
+ *
+ * \return Mask of pcmk__codec_mask() values
+ */
+uint8_t
+pcmk__codecs_supported(void)
+{
+    uint8_t codecs = pcmk__codec_mask(pcmk__codec_bzip2);
+
+#if HAVE_LZ4
+    codecs |= pcmk__codec_mask(pcmk__codec_lz4);
+#endif
+    return codecs;
+}
+
+/*!
+ * \internal
+ * \brief Choose the codec to use when sending to a peer
+ *
+ * \param[in] peer_codecs  Mask of codecs the peer has said it can decompress
+ *                         (0 for a peer that has not said, which can only
+ *                         handle bzip2)
+ *
+ * \return Fastest codec that both sides support
+ */
+enum pcmk__codec
+pcmk__codec_choose(uint8_t peer_codecs)
+{
+    uint8_t common = pcmk__codecs_supported() & peer_codecs;
+
+    if (common & pcmk__codec_mask(pcmk__codec_lz4)) {
+        return pcmk__codec_lz4;
+    }
+    return pcmk__codec_bzip2;
+}
+
+const char *
+pcmk__codec_text(enum pcmk__codec codec)
+{
+    switch (codec) {
+        case pcmk__codec_bzip2:
+            return "bzip2";
+        case pcmk__codec_lz4:
+            return "lz4";
+    }
+    return "unknown";
+}
+
+/*!
+ * \internal
+ * \brief Compress a buffer
+ *
+ * \param[in]  codec       Codec to use
+ * \param[in]  data        Data to compress
+ * \param[in]  length      Number of bytes of \p data to compress
+ * \param[in]  max         Fail if the result would be bigger than this
+ *                         (or 0 to use the codec's worst case)
+ * \param[out] result      Where to store newly allocated compressed data
+ * \param[out] result_len  Where to store size of \p result
+ *
+ * \return TRUE on success, FALSE otherwise
+ */
 bool
-crm_compress_string(const char *data, int length, int max, char **result, unsigned int *result_len)
+pcmk__compress(enum pcmk__codec codec, const char *data, int length, int max,
+               char **result, unsigned int *result_len)
 {
     int rc;
     char *compressed = NULL;
-    char *uncompressed = strdup(data);
 #ifdef CLOCK_MONOTONIC
     struct timespec after_t;
     struct timespec before_t;
@@ -411,35 +478,120 @@ crm_compress_string(const char *data, int length, int max, char **result, unsign
     compressed = calloc(max, sizeof(char));
     CRM_ASSERT(compressed);
 
-    *result_len = max;
-    rc = BZ2_bzBuffToBuffCompress(compressed, result_len, uncompressed, length, CRM_BZ2_BLOCKS, 0,
-                                  CRM_BZ2_WORK);
+    switch (codec) {
+#if HAVE_LZ4
+        case pcmk__codec_lz4:
+            rc = LZ4_compress_default(data, compressed, length, max);
+            if (rc <= 0) {
+                crm_debug("Compression of %d bytes into at most %d failed "
+                          CRM_XS " codec=lz4 rc=%d", length, max, rc);
+                free(compressed);
+                return FALSE;
+            }
+            *result_len = rc;
+            break;
+#endif
 
-    free(uncompressed);
+        case pcmk__codec_bzip2:
+        {
+            /* bzip2 does not take const input */
+            char *uncompressed = strdup(data);
+
+            *result_len = max;
+            rc = BZ2_bzBuffToBuffCompress(compressed, result_len, uncompressed,
+                                          length, CRM_BZ2_BLOCKS, 0,
+                                          CRM_BZ2_WORK);
+            free(uncompressed);
+
+            if (rc != BZ_OK) {
+                crm_err("Compression of %d bytes failed: %s " CRM_XS " bzerror=%d",
+                        length, bz2_strerror(rc), rc);
+                free(compressed);
+                return FALSE;
+            }
+            break;
+        }
 
-    if (rc != BZ_OK) {
-        crm_err("Compression of %d bytes failed: %s " CRM_XS " bzerror=%d",
-                length, bz2_strerror(rc), rc);
-        free(compressed);
-        return FALSE;
+        default:
+            crm_err("Compression of %d bytes failed: %s codec not supported",
+                    length, pcmk__codec_text(codec));
+            free(compressed);
+            return FALSE;
     }
 
 #ifdef CLOCK_MONOTONIC
     clock_gettime(CLOCK_MONOTONIC, &after_t);
 
-    crm_trace("Compressed %d bytes into %d (ratio %d:1) in %.0fms",
-             length, *result_len, length / (*result_len),
+    crm_trace("Compressed %d bytes into %d with %s (ratio %d:1) in %.0fms",
+             length, *result_len, pcmk__codec_text(codec),
+             length / (*result_len),
              difftime (after_t.tv_sec, before_t.tv_sec) * 1000 +
              (after_t.tv_nsec - before_t.tv_nsec) / 1e6);
 #else
-    crm_trace("Compressed %d bytes into %d (ratio %d:1)",
-             length, *result_len, length / (*result_len));
+    crm_trace("Compressed %d bytes into %d with %s (ratio %d:1)",
+             length, *result_len, pcmk__codec_text(codec),
+             length / (*result_len));
 #endif
 
     *result = compressed;
     return TRUE;
 }
 
+/*!
+ * \internal
+ * \brief Decompress a buffer
+ *
+ * \param[in]     codec       Codec \p data was compressed with
+ * \param[in]     data        Data to decompress
+ * \param[in]     length      Size of \p data
+ * \param[out]    result      Where to store decompressed data
+ * \param[in,out] result_len  Size of \p result on input, bytes stored in it
+ *                            on output
+ *
+ * \return pcmk_ok on success, -EILSEQ otherwise
+ */
+int
+pcmk__decompress(enum pcmk__codec codec, const char *data, unsigned int length,
+                 char *result, unsigned int *result_len)
+{
+    int rc = 0;
+
+    switch (codec) {
+#if HAVE_LZ4
+        case pcmk__codec_lz4:
+            rc = LZ4_decompress_safe(data, result, length, *result_len);
+            if (rc < 0) {
+                crm_err("Decompression failed " CRM_XS " codec=lz4 rc=%d", rc);
+                return -EILSEQ;
+            }
+            *result_len = rc;
+            return pcmk_ok;
+#endif
+
+        case pcmk__codec_bzip2:
+            rc = BZ2_bzBuffToBuffDecompress(result, result_len, (char *) data,
+                                            length, 1, 0);
+            if (rc != BZ_OK) {
+                crm_err("Decompression failed: %s " CRM_XS " bzerror=%d",
+                        bz2_strerror(rc), rc);
+                return -EILSEQ;
+            }
+            return pcmk_ok;
+
+        default:
+            crm_err("Decompression failed: %s codec not supported",
+                    pcmk__codec_text(codec));
+            return -EILSEQ;
+    }
+}
+
+bool
+crm_compress_string(const char *data, int length, int max, char **result, unsigned int *result_len)
+{
+    return pcmk__compress(pcmk__codec_bzip2, data, length, max, result,
+                          result_len);
+}
+
 /*!
  * \brief Compare two strings alphabetically (case-insensitive)
  *
@@ -14,10 +14,12 @@
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <stdarg.h>
 
 #include <libxml/parser.h>
+#include <libxml/parserInternals.h>  /* inputPush() */
 #include <libxml/tree.h>
 
 #include <crm/crm.h>
@@ -185,6 +187,94 @@ set_doc_flag(xmlNode *xml, long flag)
     }
 }
 
+/* 64-bit FNV-1a */
+#define XML_HASH_OFFSET 14695981039346656037ULL
+#define XML_HASH_PRIME  1099511628211ULL
+
+static inline uint64_t
+__xml_hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *lpc = data;
+    const unsigned char *end = lpc + len;
+
+    for (; lpc < end; lpc++) {
+        hash ^= *lpc;
+        hash *= XML_HASH_PRIME;
+    }
+    return hash;
+}
+
+static inline uint64_t
+__xml_hash_str(uint64_t hash, const char *text)
+{
+    /* Include the terminator, so that "ab"+"c" differs from "a"+"bc" */
+    if (text == NULL) {
+        text = "";
+    }
+    return __xml_hash_bytes(hash, text, strlen(text) + 1);
+}
+
+static uint64_t
+__xml_hash_node(xmlNode *xml)
+{
+    uint64_t hash = XML_HASH_OFFSET;
+
+    if (xml->type == XML_COMMENT_NODE) {
+        hash = __xml_hash_str(hash, "<!--");
+        hash = __xml_hash_str(hash, (const char *) xml->content);
+
+    } else {
+        xmlNode *cIter = NULL;
+        xmlAttr *pIter = NULL;
+
+        hash = __xml_hash_str(hash, "<");
+        hash = __xml_hash_str(hash, (const char *) xml->name);
+
+        for (pIter = xml->properties; pIter != NULL; pIter = pIter->next) {
+            xml_private_t *ap = pIter->_private;
+
+            if (ap && is_set(ap->flags, xpf_deleted)) {
+                continue;
+            }
+            hash = __xml_hash_str(hash, (const char *) pIter->name);
+            hash = __xml_hash_str(hash, pIter->children?
+                                  (const char *) pIter->children->content : NULL);
+        }
+
+        /* Text is ignored, as it is when dumping XML for digests */
+        for (cIter = xml->children; cIter != NULL; cIter = cIter->next) {
+            if (cIter->type == XML_ELEMENT_NODE || cIter->type == XML_COMMENT_NODE) {
+                uint64_t child = __xml_hash_node(cIter);
+
+                hash = __xml_hash_bytes(hash, &child, sizeof(child));
+            }
+        }
+        hash = __xml_hash_str(hash, ">");
+    }
+    return hash;
+}
+
+/*!
+ * \internal
+ * \brief Calculate a hash of an XML subtree
+ *
+ * This is much cheaper than a digest, because nothing is serialized.
+ *
+ * \param[in] xml  Root of XML to hash
+ *
+ * \return 64-bit hash of \p xml (0 if NULL)
+ * \note This is only suitable for local equality checks, not for digests
+ *       that are stored or exchanged with peers (which must remain v1/v2).
+ */
+uint64_t
+crm_xml_hash(xmlNode *xml)
+{
+    if (xml == NULL) {
+        return 0;
+    }
+    return __xml_hash_node(xml);
+}
+
 static void
 __xml_node_dirty(xmlNode *xml) 
 {
@@ -267,6 +357,165 @@ crm_first_attr(const xmlNode *xml)
 
 #define XML_PRIVATE_MAGIC (long) 0x81726354
 
+/* Every element, attribute and comment carries an xml_private_t, so a large
+ * CIB copy needs hundreds of thousands of them.  Rather than calloc() each one,
+ * they are carved out of fixed-size slabs.  Slabs are aligned to their own
+ * size, so the slab owning any slot can be found by masking its address, and
+ * a slab is handed back to the system as soon as its last slot is released
+ * (unless it is the only one with room left).
+ *
+ * A per-document arena would not be safe here: libxml2 invokes the register
+ * hook for elements before node->doc is set, and deregisters a document before
+ * its children.
+ */
+#define XML_PRIVATE_SLAB_SIZE 16384
+
+typedef union xml_private_slot_u {
+    xml_private_t priv;
+    union xml_private_slot_u *next_free;
+} xml_private_slot_t;
+
+typedef struct xml_private_slab_s {
+    struct xml_private_slab_s *prev;
+    struct xml_private_slab_s *next;
+    xml_private_slot_t *free_slots;
+    unsigned int used;
+} xml_private_slab_t;
+
+#define XML_PRIVATE_SLAB_SLOTS \
+    ((XML_PRIVATE_SLAB_SIZE - sizeof(xml_private_slab_t)) / sizeof(xml_private_slot_t))
+
+/* Slabs that still have at least one free slot */
+static xml_private_slab_t *xml_private_slabs = NULL;
+static crm_xml_alloc_stats_t xml_alloc_stats;
+
+static inline xml_private_slab_t *
+__xml_private_slab(xml_private_t *p)
+{
+    return (xml_private_slab_t *) ((uintptr_t) p
+                                   & ~((uintptr_t) XML_PRIVATE_SLAB_SIZE - 1));
+}
+
+static void
+__xml_private_slab_link(xml_private_slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = xml_private_slabs;
+    if (xml_private_slabs) {
+        xml_private_slabs->prev = slab;
+    }
+    xml_private_slabs = slab;
+}
+
+static void
+__xml_private_slab_unlink(xml_private_slab_t *slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        xml_private_slabs = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+static xml_private_slab_t *
+__xml_private_slab_new(void)
+{
+    int lpc = 0;
+    void *mem = NULL;
+    xml_private_slab_t *slab = NULL;
+    xml_private_slot_t *slots = NULL;
+
+    if (posix_memalign(&mem, XML_PRIVATE_SLAB_SIZE, XML_PRIVATE_SLAB_SIZE) != 0) {
+        return NULL;
+    }
+
+    slab = mem;
+    slab->used = 0;
+    slab->free_slots = NULL;
+    slots = (xml_private_slot_t *) (slab + 1);
+
+    for (lpc = XML_PRIVATE_SLAB_SLOTS - 1; lpc >= 0; lpc--) {
+        slots[lpc].next_free = slab->free_slots;
+        slab->free_slots = &(slots[lpc]);
+    }
+
+    __xml_private_slab_link(slab);
+    xml_alloc_stats.slabs_created++;
+    return slab;
+}
+
+static xml_private_t *
+__xml_private_alloc(void)
+{
+    xml_private_slot_t *slot = NULL;
+    xml_private_slab_t *slab = xml_private_slabs;
+
+    if (slab == NULL) {
+        slab = __xml_private_slab_new();
+        CRM_ASSERT(slab != NULL);
+    }
+
+    slot = slab->free_slots;
+    slab->free_slots = slot->next_free;
+    slab->used++;
+
+    if (slab->free_slots == NULL) {
+        __xml_private_slab_unlink(slab);
+    }
+
+    xml_alloc_stats.allocs++;
+    xml_alloc_stats.live++;
+    if (xml_alloc_stats.live > xml_alloc_stats.peak) {
+        xml_alloc_stats.peak = xml_alloc_stats.live;
+    }
+
+    memset(&(slot->priv), 0, sizeof(xml_private_t));
+    return &(slot->priv);
+}
+
+static void
+__xml_private_release(xml_private_t *p)
+{
+    xml_private_slot_t *slot = (xml_private_slot_t *) p;
+    xml_private_slab_t *slab = __xml_private_slab(p);
+
+    if (slab->free_slots == NULL) {
+        /* It was full, so it has room again */
+        __xml_private_slab_link(slab);
+    }
+
+    slot->next_free = slab->free_slots;
+    slab->free_slots = slot;
+    slab->used--;
+
+    xml_alloc_stats.frees++;
+    xml_alloc_stats.live--;
+
+    if (slab->used == 0 && (slab->prev || slab->next)) {
+        __xml_private_slab_unlink(slab);
+        free(slab);
+        xml_alloc_stats.slabs_freed++;
+    }
+}
+
+/*!
+ * \internal
+ * \brief Retrieve allocation counters for XML node private data
+ *
+ * \param[out] stats  Where to store the current counters
+ */
+void
+crm_xml_alloc_stats(crm_xml_alloc_stats_t *stats)
+{
+    CRM_CHECK(stats != NULL, return);
+    *stats = xml_alloc_stats;
+}
+
 static void
 __xml_acl_free(void *data)
 {
@@ -281,12 +530,8 @@ __xml_acl_free(void *data)
 static void
 __xml_deleted_obj_free(void *data)
 {
-    if(data) {
-        xml_deleted_obj_t *deleted_obj = data;
-
-        free(deleted_obj->path);
-        free(deleted_obj);
-    }
+    /* The path is allocated along with the object itself */
+    free(data);
 }
 
 static void
@@ -314,8 +559,10 @@ __xml_private_clean(xml_private_t *p)
 static void
 __xml_private_free(xml_private_t *p)
 {
-    __xml_private_clean(p);
-    free(p);
+    if(p) {
+        __xml_private_clean(p);
+        __xml_private_release(p);
+    }
 }
 
 static void
@@ -344,7 +591,7 @@ pcmkRegisterNode(xmlNodePtr node)
         case XML_DOCUMENT_NODE:
         case XML_ATTRIBUTE_NODE:
         case XML_COMMENT_NODE:
-            p = calloc(1, sizeof(xml_private_t));
+            p = __xml_private_alloc();
             p->check = XML_PRIVATE_MAGIC;
             /* Flags will be reset if necessary when tracking is enabled */
             p->flags |= (xpf_dirty|xpf_created);
@@ -896,6 +1143,87 @@ bool xml_document_dirty(xmlNode *xml)
     return FALSE;
 }
 
+/*!
+ * \internal
+ * \brief Set or clear the flag recording that a tracked document has changed
+ *
+ * Which nodes changed is still recorded when the flag is cleared, so a caller
+ * can clear it to see whether one step of a larger change did anything, as
+ * long as it sets the flag again afterward if any step did.
+ *
+ * \param[in,out] xml    Any node in the document
+ * \param[in]     dirty  Whether to set (TRUE) or clear (FALSE) the flag
+ */
+void
+xml_document_set_dirty(xmlNode *xml, bool dirty)
+{
+    if(xml != NULL && xml->doc && xml->doc->_private) {
+        xml_private_t *doc = xml->doc->_private;
+
+        if(dirty) {
+            set_bit(doc->flags, xpf_dirty);
+        } else {
+            clear_bit(doc->flags, xpf_dirty);
+        }
+    }
+}
+
+/*!
+ * \internal
+ * \brief Check whether all tracked changes are below one top-level section
+ *
+ * \param[in] xml      Root of XML with changes being tracked
+ * \param[in] section  Name of top-level child of \p xml
+ *
+ * \return TRUE if only descendants of \p section (or the section itself)
+ *         were created, changed or deleted, FALSE otherwise (including when
+ *         changes are not being tracked)
+ */
+bool
+xml_changes_within(xmlNode *xml, const char *section)
+{
+    size_t len = 0;
+    char *prefix = NULL;
+    bool within = TRUE;
+    GListPtr gIter = NULL;
+    xmlNode *cIter = NULL;
+    xmlAttr *pIter = NULL;
+    xml_private_t *doc = NULL;
+
+    if (xml == NULL || TRACKING_CHANGES(xml) == FALSE) {
+        return FALSE;
+    }
+
+    for (pIter = crm_first_attr(xml); pIter != NULL; pIter = pIter->next) {
+        xml_private_t *p = pIter->_private;
+
+        if (p->flags & (xpf_dirty|xpf_deleted|xpf_created)) {
+            return FALSE;
+        }
+    }
+
+    for (cIter = __xml_first_child(xml); cIter != NULL; cIter = __xml_next(cIter)) {
+        xml_private_t *p = cIter->_private;
+
+        if (p && (p->flags & (xpf_dirty|xpf_created))
+            && safe_str_neq((const char *) cIter->name, section)) {
+            return FALSE;
+        }
+    }
+
+    /* Deleting the section itself is not below it */
+    prefix = crm_strdup_printf("/%s/%s/", (const char *) xml->name, section);
+    len = strlen(prefix);
+    doc = xml->doc->_private;
+    for (gIter = doc->deleted_objs; within && gIter; gIter = gIter->next) {
+        xml_deleted_obj_t *deleted_obj = gIter->data;
+
+        within = (strncmp(deleted_obj->path, prefix, len) == 0);
+    }
+    free(prefix);
+    return within;
+}
+
 /*
 <diff format="2.0">
   <version>
@@ -1906,146 +2234,341 @@ xml_apply_patchset_v1(xmlNode *xml, xmlNode *patchset)
     return rc;
 }
 
-static xmlNode *
-__first_xml_child_match(xmlNode *parent, const char *name, const char *id, int position)
+/* Key for looking up a child by tag and id.  Lookups point into the patch
+ * path being resolved; stored keys own a copy of both strings.
+ */
+typedef struct xml_child_key_s {
+    const char *tag;
+    size_t tag_len;
+    const char *id;
+    size_t id_len;
+} xml_child_key_t;
+
+/* Parents with fewer children than this are simply searched */
+#define XML_INDEX_MIN_CHILDREN 16
+
+static inline bool
+__xml_str_eq_len(const char *s, const char *text, size_t len)
 {
-    xmlNode *cIter = NULL;
+    return (s != NULL) && (strncmp(s, text, len) == 0) && (s[len] == '\0');
+}
 
-    for (cIter = __xml_first_child(parent); cIter != NULL; cIter = __xml_next(cIter)) {
-        if(strcmp((const char *)cIter->name, name) != 0) {
-            continue;
-        } else if(id) {
-            const char *cid = ID(cIter);
-            if(cid == NULL || strcmp(cid, id) != 0) {
-                continue;
-            }
-        }
+static guint
+__xml_child_key_hash(gconstpointer data)
+{
+    const xml_child_key_t *key = data;
+    uint64_t hash = XML_HASH_OFFSET;
 
-        /* The "position" makes sense only for XML comments for now */
-        if (cIter->type == XML_COMMENT_NODE
-            && position >= 0
-            && __xml_offset(cIter) != position) {
-            continue;
-        }
+    hash = __xml_hash_bytes(hash, key->tag, key->tag_len);
+    hash = __xml_hash_bytes(hash, "", 1);
+    hash = __xml_hash_bytes(hash, key->id, key->id_len);
+    return (guint) (hash ^ (hash >> 32));
+}
 
-        return cIter;
+static gboolean
+__xml_child_key_equal(gconstpointer a, gconstpointer b)
+{
+    const xml_child_key_t *ka = a;
+    const xml_child_key_t *kb = b;
+
+    return (ka->tag_len == kb->tag_len) && (ka->id_len == kb->id_len)
+           && (memcmp(ka->tag, kb->tag, ka->tag_len) == 0)
+           && (memcmp(ka->id, kb->id, ka->id_len) == 0);
+}
+
+static void
+__xml_index_insert(GHashTable *children, xmlNode *child)
+{
+    const char *id = ID(child);
+    size_t tag_len = 0;
+    size_t id_len = 0;
+    xml_child_key_t *key = NULL;
+    char *strings = NULL;
+
+    if (id == NULL || child->type != XML_ELEMENT_NODE) {
+        return;
+    }
+    tag_len = strlen((const char *) child->name);
+    id_len = strlen(id);
+
+    /* One allocation for the key and both strings */
+    key = malloc(sizeof(xml_child_key_t) + tag_len + id_len + 2);
+    CRM_ASSERT(key != NULL);
+    strings = (char *) (key + 1);
+
+    memcpy(strings, child->name, tag_len + 1);
+    memcpy(strings + tag_len + 1, id, id_len + 1);
+    key->tag = strings;
+    key->tag_len = tag_len;
+    key->id = strings + tag_len + 1;
+    key->id_len = id_len;
+
+    if (g_hash_table_lookup(children, key) != NULL) {
+        /* Keep the first match, as a search would */
+        free(key);
+    } else {
+        g_hash_table_insert(children, key, child);
     }
-    return NULL;
 }
 
 /*!
  * \internal
- * \brief Simplified, more efficient alternative to get_xpath_object()
+ * \brief Find the first child of a parent with a given tag and id
  *
- * \param[in] top              Root of XML to search
- * \param[in] key              Search xpath
- * \param[in] target_position  If deleting, where to delete
+ * \param[in] index     Table of parent -> (tag, id) -> child (or NULL)
+ * \param[in] parent    Node whose children should be searched
+ * \param[in] key       Tag and id to search for
  *
- * \return XML child matching xpath if found, NULL otherwise
+ * \return First matching child if found, NULL otherwise
  *
- * \note This only works on simplified xpaths found in v2 patchset diffs,
- *       i.e. the only allowed search predicate is [@id='XXX'].
+ * \note The index is a cache: entries are checked before being used, and a
+ *       miss falls back to a search.  A parent is only indexed once a search
+ *       of it has had to look at more than XML_INDEX_MIN_CHILDREN children.
  */
 static xmlNode *
-__xml_find_path(xmlNode *top, const char *key, int target_position)
+__xml_index_find(GHashTable *index, xmlNode *parent, xml_child_key_t *key)
 {
-    xmlNode *target = (xmlNode*) top->doc;
-    const char *current = key;
-    char *section;
-    char *remainder;
-    char *id;
-    char *tag;
-    char *path = NULL;
-    int rc;
-    size_t key_len;
+    int scanned = 0;
+    xmlNode *cIter = NULL;
+    GHashTable *children = NULL;
 
-    CRM_CHECK(key != NULL, return NULL);
-    key_len = strlen(key);
+    if (index) {
+        children = g_hash_table_lookup(index, parent);
+    }
 
-    /* These are scanned from key after a slash, so they can't be bigger
-     * than key_len - 1 characters plus a null terminator.
-     */
+    if (children) {
+        xmlNode *match = g_hash_table_lookup(children, key);
 
-    remainder = calloc(key_len, sizeof(char));
-    CRM_ASSERT(remainder != NULL);
+        if (match && match->parent == parent
+            && __xml_str_eq_len((const char *) match->name, key->tag, key->tag_len)
+            && __xml_str_eq_len(ID(match), key->id, key->id_len)) {
+            return match;
+        }
+    }
 
-    section = calloc(key_len, sizeof(char));
-    CRM_ASSERT(section != NULL);
+    for (cIter = __xml_first_child(parent); cIter != NULL; cIter = __xml_next(cIter)) {
+        scanned++;
+        if (__xml_str_eq_len((const char *) cIter->name, key->tag, key->tag_len)
+            && __xml_str_eq_len(ID(cIter), key->id, key->id_len)) {
+            break;
+        }
+    }
 
-    id = calloc(key_len, sizeof(char));
-    CRM_ASSERT(id != NULL);
+    if (index == NULL) {
+        return cIter;
 
-    tag = calloc(key_len, sizeof(char));
-    CRM_ASSERT(tag != NULL);
+    } else if (children) {
+        if (cIter) {
+            /* Replaces any stale entry */
+            g_hash_table_remove(children, key);
+            __xml_index_insert(children, cIter);
+        }
 
-    do {
-        // Look for /NEXT_COMPONENT/REMAINING_COMPONENTS
-        rc = sscanf(current, "/%[^/]%s", section, remainder);
-        if (rc > 0) {
-            // Separate FIRST_COMPONENT into TAG[@id='ID']
-            int f = sscanf(section, "%[^[][@id='%[^']", tag, id);
-            int current_position = -1;
-
-            /* The target position is for the final component tag, so only use
-             * it if there is nothing left to search after this component.
-             */
-            if ((rc == 1) && (target_position >= 0)) {
-                current_position = target_position;
-            }
+    } else if (scanned > XML_INDEX_MIN_CHILDREN) {
+        xmlNode *child = NULL;
 
-            switch (f) {
-                case 1:
-                    target = __first_xml_child_match(target, tag, NULL, current_position);
-                    break;
-                case 2:
-                    target = __first_xml_child_match(target, tag, id, current_position);
-                    break;
-                default:
-                    // This should not be possible
-                    target = NULL;
-                    break;
-            }
-            current = remainder;
+        children = g_hash_table_new_full(__xml_child_key_hash,
+                                         __xml_child_key_equal, free, NULL);
+        for (child = __xml_first_child(parent); child != NULL; child = __xml_next(child)) {
+            __xml_index_insert(children, child);
         }
+        g_hash_table_insert(index, parent, children);
+    }
+    return cIter;
+}
 
-    // Continue if something remains to search, and we've matched so far
-    } while ((rc == 2) && target);
+/*!
+ * \internal
+ * \brief Drop any index entry that could lead to a node
+ *
+ * \param[in] index  Table of parent -> (tag, id) -> child
+ * \param[in] xml    Node about to be freed or moved
+ * \param[in] freed  Whether \p xml (and its children) will be freed
+ */
+static void
+__xml_index_forget(GHashTable *index, xmlNode *xml, bool freed)
+{
+    const char *id = ID(xml);
 
-    if (target) {
-        crm_trace("Found %s for %s",
-                  (path = (char *) xmlGetNodePath(target)), key);
-        free(path);
-    } else {
-        crm_debug("No match for %s", key);
+    if (index == NULL) {
+        return;
     }
 
-    free(remainder);
-    free(section);
-    free(tag);
-    free(id);
-    return target;
-}
+    if (xml->parent && id) {
+        GHashTable *children = g_hash_table_lookup(index, xml->parent);
 
-static int
-xml_apply_patchset_v2(xmlNode *xml, xmlNode *patchset)
-{
-    int rc = pcmk_ok;
-    xmlNode *change = NULL;
-    for (change = __xml_first_child(patchset); change != NULL; change = __xml_next(change)) {
-        xmlNode *match = NULL;
-        const char *op = crm_element_value(change, XML_DIFF_OP);
-        const char *xpath = crm_element_value(change, XML_DIFF_PATH);
-        int position = -1;
+        if (children) {
+            xml_child_key_t key = {
+                (const char *) xml->name, strlen((const char *) xml->name),
+                id, strlen(id)
+            };
 
-        crm_trace("Processing %s %s", change->name, op);
-        if(op == NULL) {
-            continue;
+            g_hash_table_remove(children, &key);
         }
+    }
 
-        if(strcmp(op, "delete") == 0) {
+    if (freed) {
+        xmlNode *cIter = NULL;
+
+        g_hash_table_remove(index, xml);
+        for (cIter = __xml_first_child(xml); cIter != NULL; cIter = __xml_next(cIter)) {
+            if (cIter->type == XML_ELEMENT_NODE) {
+                __xml_index_forget(index, cIter, TRUE);
+            }
+        }
+    }
+}
+
+static xmlNode *
+__first_xml_child_match(xmlNode *parent, const char *name, size_t name_len, int position)
+{
+    xmlNode *cIter = NULL;
+
+    for (cIter = __xml_first_child(parent); cIter != NULL; cIter = __xml_next(cIter)) {
+        if (__xml_str_eq_len((const char *) cIter->name, name, name_len) == FALSE) {
+            continue;
+        }
+
+        /* The "position" makes sense only for XML comments for now */
+        if (cIter->type == XML_COMMENT_NODE
+            && position >= 0
+            && __xml_offset(cIter) != position) {
+            continue;
+        }
+
+        return cIter;
+    }
+    return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Split the next component off a simplified xpath, without copying
+ *
+ * \param[in,out] path  Remaining path, advanced past the component on success
+ * \param[out]    key   Tag and id (id_len 0 if none) of the component
+ *
+ * \return TRUE if a component was found, FALSE at the end of the path or if
+ *         it is not of the form /TAG or /TAG[@id='ID']
+ */
+static bool
+__xml_next_path_component(const char **path, xml_child_key_t *key)
+{
+    static const char id_prefix[] = "[@id='";
+    const char *lpc = *path;
+
+    if (*lpc != '/') {
+        return FALSE;
+    }
+
+    key->tag = ++lpc;
+    lpc += strcspn(lpc, "[/");
+    key->tag_len = lpc - key->tag;
+    key->id = NULL;
+    key->id_len = 0;
+
+    if (key->tag_len == 0) {
+        return FALSE;
+    }
+
+    if (strncmp(lpc, id_prefix, sizeof(id_prefix) - 1) == 0) {
+        key->id = lpc + sizeof(id_prefix) - 1;
+        key->id_len = strcspn(key->id, "'");
+        lpc = key->id + key->id_len;
+        if (key->id_len == 0 || *lpc == '\0') {
+            return FALSE;
+        }
+    }
+
+    /* Skip the rest of the component, including any closing "']" */
+    *path = lpc + strcspn(lpc, "/");
+    return TRUE;
+}
+
+/*!
+ * \internal
+ * \brief Simplified, more efficient alternative to get_xpath_object()
+ *
+ * \param[in] top              Root of XML to search
+ * \param[in] key              Search xpath
+ * \param[in] target_position  If deleting, where to delete
+ * \param[in] index            Child index to use and extend (or NULL)
+ *
+ * \return XML child matching xpath if found, NULL otherwise
+ *
+ * \note This only works on simplified xpaths found in v2 patchset diffs,
+ *       i.e. the only allowed search predicate is [@id='XXX'].
+ */
+static xmlNode *
+__xml_find_path(xmlNode *top, const char *key, int target_position,
+                GHashTable *index)
+{
+    xmlNode *target = (xmlNode*) top->doc;
+    const char *current = key;
+    char *path = NULL;
+    xml_child_key_t component;
+
+    CRM_CHECK(key != NULL, return NULL);
+
+    while (target && __xml_next_path_component(&current, &component)) {
+        if (component.id) {
+            target = __xml_index_find(index, target, &component);
+
+        } else {
+            /* The target position is for the final component tag, so only
+             * use it if there is nothing left to search after this component.
+             */
+            int current_position = (*current == '\0')? target_position : -1;
+
+            target = __first_xml_child_match(target, component.tag,
+                                             component.tag_len,
+                                             current_position);
+        }
+    }
+
+    if (target && *current != '\0') {
+        // This should not be possible
+        target = NULL;
+    }
+
+    if (target) {
+        crm_trace("Found %s for %s",
+                  (path = (char *) xmlGetNodePath(target)), key);
+        free(path);
+    } else {
+        crm_debug("No match for %s", key);
+    }
+
+    return target;
+}
+
+static int
+xml_apply_patchset_v2(xmlNode *xml, xmlNode *patchset)
+{
+    int rc = pcmk_ok;
+    xmlNode *change = NULL;
+
+    /* Large status updates resolve many paths below the same parents, so
+     * index the children of busy parents for the rest of this patchset.
+     */
+    GHashTable *index = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                              NULL, (GDestroyNotify) g_hash_table_destroy);
+
+    for (change = __xml_first_child(patchset); change != NULL; change = __xml_next(change)) {
+        xmlNode *match = NULL;
+        const char *op = crm_element_value(change, XML_DIFF_OP);
+        const char *xpath = crm_element_value(change, XML_DIFF_PATH);
+        int position = -1;
+
+        crm_trace("Processing %s %s", change->name, op);
+        if(op == NULL) {
+            continue;
+        }
+
+        if(strcmp(op, "delete") == 0) {
             crm_element_value_int(change, XML_DIFF_POSITION, &position);
         }
-        match = __xml_find_path(xml, xpath, position);
+        match = __xml_find_path(xml, xpath, position, index);
         crm_trace("Performing %s on %s with %p", op, xpath, match);
 
         if(match == NULL && strcmp(op, "delete") == 0) {
@@ -2083,6 +2606,9 @@ xml_apply_patchset_v2(xmlNode *xml, xmlNode *patchset)
                 CRM_LOG_ASSERT(position == 0);
                 xmlAddChild(match, child);
             }
+
+            /* An existing sibling may no longer be the first match */
+            __xml_index_forget(index, child, FALSE);
             crm_node_created(child);
 
         } else if(strcmp(op, "move") == 0) {
@@ -2098,6 +2624,7 @@ xml_apply_patchset_v2(xmlNode *xml, xmlNode *patchset)
                 }
 
                 CRM_ASSERT(match->parent != NULL);
+                __xml_index_forget(index, match, FALSE);
                 match_child = match->parent->children;
 
                 while(match_child && p != __xml_offset(match_child)) {
@@ -2127,6 +2654,7 @@ xml_apply_patchset_v2(xmlNode *xml, xmlNode *patchset)
             }
 
         } else if(strcmp(op, "delete") == 0) {
+            __xml_index_forget(index, match, TRUE);
             free_xml(match);
 
         } else if(strcmp(op, "modify") == 0) {
@@ -2155,6 +2683,8 @@ xml_apply_patchset_v2(xmlNode *xml, xmlNode *patchset)
             crm_err("Unknown operation: %s", op);
         }
     }
+
+    g_hash_table_destroy(index);
     return rc;
 }
 
@@ -2409,6 +2939,57 @@ expand_plus_plus(xmlNode * target, const char *name, const char *value)
     return;
 }
 
+/* Documents created or parsed here share one dictionary, so each element and
+ * attribute name is stored once rather than once per node, and a name taken
+ * from one document is pointer-equal to the same name in another (which
+ * libxml2's lookups check before comparing characters).
+ *
+ * Besides names, the parser only interns values of up to three characters and
+ * whitespace, so the dictionary stays small.  It must never be replaced:
+ * libxml2 does not move interned text between dictionaries when a node moves
+ * to another document, so all documents have to use the same one.
+ */
+static xmlDictPtr xml_dict = NULL;
+
+static xmlDictPtr
+__xml_shared_dict(void)
+{
+    if (xml_dict == NULL) {
+        xml_dict = xmlDictCreate();
+        CRM_ASSERT(xml_dict != NULL);
+    }
+    return xml_dict;
+}
+
+static xmlDoc *
+__xml_new_doc(void)
+{
+    xmlDoc *doc = xmlNewDoc((const xmlChar *)"1.0");
+
+    CRM_ASSERT(doc != NULL);
+    doc->dict = __xml_shared_dict();
+    xmlDictReference(doc->dict);
+    return doc;
+}
+
+static void
+__xml_parser_use_shared_dict(xmlParserCtxtPtr ctxt)
+{
+    xmlDictPtr dict = __xml_shared_dict();
+
+    if (ctxt->dict == dict) {
+        return;
+    }
+    xmlDictFree(ctxt->dict);
+    ctxt->dict = dict;
+    xmlDictReference(dict);
+
+    /* These are interned in the context's dictionary when it is created */
+    ctxt->str_xml = xmlDictLookup(dict, BAD_CAST "xml", 3);
+    ctxt->str_xmlns = xmlDictLookup(dict, BAD_CAST "xmlns", 5);
+    ctxt->str_xml_ns = xmlDictLookup(dict, XML_XML_NAMESPACE, 36);
+}
+
 xmlDoc *
 getDocPtr(xmlNode * node)
 {
@@ -2418,7 +2999,7 @@ getDocPtr(xmlNode * node)
 
     doc = node->doc;
     if (doc == NULL) {
-        doc = xmlNewDoc((const xmlChar *)"1.0");
+        doc = __xml_new_doc();
         xmlDocSetRootElement(doc, node);
         xmlSetTreeDoc(node, doc);
     }
@@ -2630,7 +3211,7 @@ create_xml_node(xmlNode * parent, const char *name)
     }
 
     if (parent == NULL) {
-        doc = xmlNewDoc((const xmlChar *)"1.0");
+        doc = __xml_new_doc();
         node = xmlNewDocRawNode(doc, NULL, (const xmlChar *)name, NULL);
         xmlDocSetRootElement(doc, node);
 
@@ -2703,11 +3284,17 @@ free_xml_with_position(xmlNode * child, int position)
                 char buffer[XML_BUFFER_SIZE];
 
                 if(__get_prefix(NULL, child, buffer, offset) > 0) {
-                    xml_deleted_obj_t *deleted_obj = calloc(1, sizeof(xml_deleted_obj_t));
+                    size_t len = strlen(buffer);
+                    xml_deleted_obj_t *deleted_obj = NULL;
 
                     crm_trace("Deleting %s %p from %p", buffer, child, doc);
 
-                    deleted_obj->path = strdup(buffer);
+                    /* One allocation for the object and its path */
+                    deleted_obj = calloc(1, sizeof(xml_deleted_obj_t) + len + 1);
+                    CRM_ASSERT(deleted_obj != NULL);
+                    deleted_obj->path = (char *) (deleted_obj + 1);
+                    memcpy(deleted_obj->path, buffer, len + 1);
+                    xml_alloc_stats.deleted_objs++;
 
                     deleted_obj->position = -1;
                     /* Record the "position" only for XML comments for now */
@@ -2745,7 +3332,7 @@ free_xml(xmlNode * child)
 xmlNode *
 copy_xml(xmlNode * src)
 {
-    xmlDoc *doc = xmlNewDoc((const xmlChar *)"1.0");
+    xmlDoc *doc = __xml_new_doc();
     xmlNode *copy = xmlDocCopyNode(src, doc, 1);
 
     xmlDocSetRootElement(doc, copy);
@@ -2780,6 +3367,50 @@ crm_xml_err(void *ctx, const char *fmt, ...)
     va_end(ap);
 }
 
+/*!
+ * \internal
+ * \brief Parse a string without letting libxml2 copy it first
+ *
+ * \param[in] ctxt     Parser context to use
+ * \param[in] input    Text to parse (must not change until this returns)
+ * \param[in] options  Bitmask of xmlParserOption
+ *
+ * \return Parsed document, or NULL on error
+ * \note This is xmlCtxtReadDoc() with a static input buffer, which saves a
+ *       copy of every message received (a full CIB, for some clients).
+ */
+static xmlDoc *
+__xml_read_static(xmlParserCtxtPtr ctxt, const char *input, int options)
+{
+    xmlDoc *doc = NULL;
+    xmlParserInputPtr stream = NULL;
+    xmlParserInputBufferPtr buffer = NULL;
+
+    buffer = xmlParserInputBufferCreateStatic(input, strlen(input),
+                                              XML_CHAR_ENCODING_NONE);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    stream = xmlNewIOInputStream(ctxt, buffer, XML_CHAR_ENCODING_NONE);
+    if (stream == NULL) {
+        xmlFreeParserInputBuffer(buffer);
+        return NULL;
+    }
+    inputPush(ctxt, stream);
+
+    xmlCtxtUseOptions(ctxt, options);
+    xmlParseDocument(ctxt);
+
+    if (ctxt->wellFormed || ctxt->recovery) {
+        doc = ctxt->myDoc;
+    } else if (ctxt->myDoc) {
+        xmlFreeDoc(ctxt->myDoc);
+    }
+    ctxt->myDoc = NULL;
+    return doc;
+}
+
 xmlNode *
 string2xml(const char *input)
 {
@@ -2796,15 +3427,15 @@ string2xml(const char *input)
     /* create a parser context */
     ctxt = xmlNewParserCtxt();
     CRM_CHECK(ctxt != NULL, return NULL);
+    __xml_parser_use_shared_dict(ctxt);
 
     /* xmlCtxtUseOptions(ctxt, XML_PARSE_NOBLANKS|XML_PARSE_RECOVER); */
 
     xmlCtxtResetLastError(ctxt);
     xmlSetGenericErrorFunc(ctxt, crm_xml_err);
     /* initGenericErrorDefaultFunc(crm_xml_err); */
-    output =
-        xmlCtxtReadDoc(ctxt, (const xmlChar *)input, NULL, NULL,
-                       XML_PARSE_NOBLANKS | XML_PARSE_RECOVER);
+    output = __xml_read_static(ctxt, input,
+                               XML_PARSE_NOBLANKS | XML_PARSE_RECOVER);
     if (output) {
         xml = xmlDocGetRootElement(output);
     }
@@ -2972,6 +3603,7 @@ filename2xml(const char *filename)
     /* create a parser context */
     ctxt = xmlNewParserCtxt();
     CRM_CHECK(ctxt != NULL, return NULL);
+    __xml_parser_use_shared_dict(ctxt);
 
     /* xmlCtxtUseOptions(ctxt, XML_PARSE_NOBLANKS|XML_PARSE_RECOVER); */
 
@@ -3345,29 +3977,6 @@ crm_xml_escape(const char *text)
     return copy;
 }
 
-static inline void
-dump_xml_attr(xmlAttrPtr attr, int options, char **buffer, int *offset, int *max)
-{
-    char *p_value = NULL;
-    const char *p_name = NULL;
-    xml_private_t *p = NULL;
-
-    CRM_ASSERT(buffer != NULL);
-    if (attr == NULL || attr->children == NULL) {
-        return;
-    }
-
-    p = attr->_private;
-    if (p && is_set(p->flags, xpf_deleted)) {
-        return;
-    }
-
-    p_name = (const char *)attr->name;
-    p_value = crm_xml_escape((const char *)attr->children->content);
-    buffer_print(*buffer, *max, *offset, " %s=\"%s\"", p_name, p_value);
-    free(p_value);
-}
-
 static void
 __xml_log_element(int log_level, const char *file, const char *function, int line,
                   const char *prefix, xmlNode * data, int depth, int options)
@@ -3613,14 +4222,128 @@ log_data_element(int log_level, const char *file, const char *function, int line
     free(prefix_m);
 }
 
+/* XML is serialized by walking the tree twice with the same code: first with
+ * no output buffer, to learn the exact length (including escapes), then again
+ * into a buffer of exactly that size.  This avoids both the repeated
+ * snprintf()/realloc() cycles and any intermediate per-attribute copies.
+ */
+typedef struct xml_writer_s {
+    char *out;      /* NULL while only measuring */
+    size_t len;     /* bytes measured or written so far */
+} xml_writer_t;
+
+static inline void
+xml_writer_add(xml_writer_t *w, const char *text, size_t len)
+{
+    if (w->out) {
+        memcpy(w->out + w->len, text, len);
+    }
+    w->len += len;
+}
+
+static inline void
+xml_writer_add_str(xml_writer_t *w, const char *text)
+{
+    if (text) {
+        xml_writer_add(w, text, strlen(text));
+    }
+}
+
+static inline void
+xml_writer_add_prefix(xml_writer_t *w, int options, int depth)
+{
+    if (options & xml_log_option_formatted) {
+        size_t spaces = 2 * depth;
+
+        if (w->out) {
+            memset(w->out + w->len, ' ', spaces);
+        }
+        w->len += spaces;
+    }
+}
+
+/* Must produce exactly what crm_xml_escape() would */
+static void
+xml_writer_add_escaped(xml_writer_t *w, const char *text)
+{
+    const char *start = text;
+    const char *lpc = NULL;
+
+    for (lpc = text; *lpc != 0; lpc++) {
+        const char *replace = NULL;
+        char octal[16];
+
+        switch (*lpc) {
+            case '<':
+                replace = "&lt;";
+                break;
+            case '>':
+                replace = "&gt;";
+                break;
+            case '"':
+                replace = "&quot;";
+                break;
+            case '\'':
+                replace = "&apos;";
+                break;
+            case '&':
+                replace = "&amp;";
+                break;
+            case '\t':
+                replace = "    ";
+                break;
+            case '\n':
+                replace = "\\n";
+                break;
+            case '\r':
+                replace = "\\r";
+                break;
+            default:
+                if (*lpc < ' ' || *lpc > '~') {
+                    snprintf(octal, sizeof(octal), "\\%.3o", *lpc);
+                    replace = octal;
+                }
+                break;
+        }
+
+        if (replace) {
+            xml_writer_add(w, start, lpc - start);
+            xml_writer_add_str(w, replace);
+            start = lpc + 1;
+        }
+    }
+    xml_writer_add(w, start, lpc - start);
+}
+
+static void
+xml_writer_add_attr(xml_writer_t *w, xmlAttrPtr attr)
+{
+    xml_private_t *p = NULL;
+
+    if (attr == NULL || attr->children == NULL) {
+        return;
+    }
+
+    p = attr->_private;
+    if (p && is_set(p->flags, xpf_deleted)) {
+        return;
+    }
+
+    xml_writer_add(w, " ", 1);
+    xml_writer_add_str(w, (const char *)attr->name);
+    xml_writer_add(w, "=\"", 2);
+    xml_writer_add_escaped(w, (const char *)attr->children->content);
+    xml_writer_add(w, "\"", 1);
+}
+
 static void
-dump_filtered_xml(xmlNode * data, int options, char **buffer, int *offset, int *max)
+xml_writer_add_filtered_attrs(xml_writer_t *w, xmlNode * data)
 {
     int lpc;
     xmlAttrPtr xIter = NULL;
     static int filter_len = DIMOF(filter);
 
-    for (lpc = 0; options && lpc < filter_len; lpc++) {
+    for (lpc = 0; lpc < filter_len; lpc++) {
         filter[lpc].found = FALSE;
     }
 
@@ -3637,206 +4360,100 @@ dump_filtered_xml(xmlNode * data, int options, char **buffer, int *offset, int *
         }
 
         if (skip == FALSE) {
-            dump_xml_attr(xIter, options, buffer, offset, max);
+            xml_writer_add_attr(w, xIter);
         }
     }
 }
 
+static void xml_writer_add_node(xml_writer_t *w, xmlNode * data, int options,
+                                int depth);
+
 static void
-dump_xml_element(xmlNode * data, int options, char **buffer, int *offset, int *max, int depth)
+xml_writer_add_element(xml_writer_t *w, xmlNode * data, int options, int depth)
 {
-    const char *name = NULL;
+    const char *name = crm_element_name(data);
 
-    CRM_ASSERT(max != NULL);
-    CRM_ASSERT(offset != NULL);
-    CRM_ASSERT(buffer != NULL);
-
-    if (data == NULL) {
-        crm_trace("Nothing to dump");
-        return;
-    }
-
-    if (*buffer == NULL) {
-        *offset = 0;
-        *max = 0;
-    }
-
-    name = crm_element_name(data);
     CRM_ASSERT(name != NULL);
 
-    insert_prefix(options, buffer, offset, max, depth);
-    buffer_print(*buffer, *max, *offset, "<%s", name);
+    xml_writer_add_prefix(w, options, depth);
+    xml_writer_add(w, "<", 1);
+    xml_writer_add_str(w, name);
 
     if (options & xml_log_option_filtered) {
-        dump_filtered_xml(data, options, buffer, offset, max);
+        xml_writer_add_filtered_attrs(w, data);
 
     } else {
         xmlAttrPtr xIter = NULL;
 
         for (xIter = crm_first_attr(data); xIter != NULL; xIter = xIter->next) {
-            dump_xml_attr(xIter, options, buffer, offset, max);
+            xml_writer_add_attr(w, xIter);
         }
     }
 
     if (data->children == NULL) {
-        buffer_print(*buffer, *max, *offset, "/>");
+        xml_writer_add(w, "/>", 2);
 
     } else {
-        buffer_print(*buffer, *max, *offset, ">");
+        xml_writer_add(w, ">", 1);
     }
 
     if (options & xml_log_option_formatted) {
-        buffer_print(*buffer, *max, *offset, "\n");
+        xml_writer_add(w, "\n", 1);
     }
 
     if (data->children) {
         xmlNode *xChild = NULL;
+
         for(xChild = data->children; xChild != NULL; xChild = xChild->next) {
-            crm_xml_dump(xChild, options, buffer, offset, max, depth + 1);
+            xml_writer_add_node(w, xChild, options, depth + 1);
         }
 
-        insert_prefix(options, buffer, offset, max, depth);
-        buffer_print(*buffer, *max, *offset, "</%s>", name);
+        xml_writer_add_prefix(w, options, depth);
+        xml_writer_add(w, "</", 2);
+        xml_writer_add_str(w, name);
+        xml_writer_add(w, ">", 1);
 
         if (options & xml_log_option_formatted) {
-            buffer_print(*buffer, *max, *offset, "\n");
+            xml_writer_add(w, "\n", 1);
         }
     }
 }
 
 static void
-dump_xml_text(xmlNode * data, int options, char **buffer, int *offset, int *max, int depth)
-{
-    CRM_ASSERT(max != NULL);
-    CRM_ASSERT(offset != NULL);
-    CRM_ASSERT(buffer != NULL);
-
-    if (data == NULL) {
-        crm_trace("Nothing to dump");
-        return;
-    }
-
-    if (*buffer == NULL) {
-        *offset = 0;
-        *max = 0;
-    }
-
-    insert_prefix(options, buffer, offset, max, depth);
-
-    buffer_print(*buffer, *max, *offset, "%s", data->content);
-
-    if (options & xml_log_option_formatted) {
-        buffer_print(*buffer, *max, *offset, "\n");
-    }
-}
-
-
-static void
-dump_xml_comment(xmlNode * data, int options, char **buffer, int *offset, int *max, int depth)
+xml_writer_add_node(xml_writer_t *w, xmlNode * data, int options, int depth)
 {
-    CRM_ASSERT(max != NULL);
-    CRM_ASSERT(offset != NULL);
-    CRM_ASSERT(buffer != NULL);
-
-    if (data == NULL) {
-        crm_trace("Nothing to dump");
-        return;
-    }
-
-    if (*buffer == NULL) {
-        *offset = 0;
-        *max = 0;
-    }
-
-    insert_prefix(options, buffer, offset, max, depth);
-
-    buffer_print(*buffer, *max, *offset, "<!--");
-    buffer_print(*buffer, *max, *offset, "%s", data->content);
-    buffer_print(*buffer, *max, *offset, "-->");
-
-    if (options & xml_log_option_formatted) {
-        buffer_print(*buffer, *max, *offset, "\n");
-    }
-}
-
-void
-crm_xml_dump(xmlNode * data, int options, char **buffer, int *offset, int *max, int depth)
-{
-    if(data == NULL) {
-        *offset = 0;
-        *max = 0;
-        return;
-    }
-#if 0
-    if (is_not_set(options, xml_log_option_filtered)) {
-        /* Turning this code on also changes the scheduler tests for some reason
-         * (not just newlines).  Figure out why before considering to
-         * enable this permanently.
-         *
-         * It exists to help debug slowness in xmlNodeDump() and
-         * potentially if we ever want to go back to it.
-         *
-         * In theory it's a good idea (reuse) but our custom version does
-         * better for the filtered case and avoids the final strdup() for
-         * everything
-         */
-
-        time_t now, next;
-        xmlDoc *doc = NULL;
-        xmlBuffer *xml_buffer = NULL;
-
-        *buffer = NULL;
-        doc = getDocPtr(data);
-        /* doc will only be NULL if data is */
-        CRM_CHECK(doc != NULL, return);
-
-        now = time(NULL);
-        xml_buffer = xmlBufferCreate();
-        CRM_ASSERT(xml_buffer != NULL);
-
-        /* The default allocator XML_BUFFER_ALLOC_EXACT does far too many
-         * realloc()s and it can take upwards of 18 seconds (yes, seconds)
-         * to dump a 28kb tree which XML_BUFFER_ALLOC_DOUBLEIT can do in
-         * less than 1 second.
-         *
-         * We could also use xmlBufferCreateSize() to start with a
-         * sane-ish initial size and avoid the first few doubles.
-         */
-        xmlBufferSetAllocationScheme(xml_buffer, XML_BUFFER_ALLOC_DOUBLEIT);
-
-        *max = xmlNodeDump(xml_buffer, doc, data, 0, (options & xml_log_option_formatted));
-        if (*max > 0) {
-            *buffer = strdup((char *)xml_buffer->content);
-        }
-
-        next = time(NULL);
-        if ((now + 1) < next) {
-            crm_log_xml_trace(data, "Long time");
-            crm_err("xmlNodeDump() -> %dbytes took %ds", *max, next - now);
-        }
-
-        xmlBufferFree(xml_buffer);
-        return;
-    }
-#endif
-
     switch(data->type) {
         case XML_ELEMENT_NODE:
-            /* Handle below */
-            dump_xml_element(data, options, buffer, offset, max, depth);
+            xml_writer_add_element(w, data, options, depth);
             break;
+
         case XML_TEXT_NODE:
             /* if option xml_log_option_text is enabled, then dump XML_TEXT_NODE */
             if (options & xml_log_option_text) {
-                dump_xml_text(data, options, buffer, offset, max, depth);
+                xml_writer_add_prefix(w, options, depth);
+                xml_writer_add_str(w, (const char *)data->content);
+                if (options & xml_log_option_formatted) {
+                    xml_writer_add(w, "\n", 1);
+                }
             }
-            return;
+            break;
+
         case XML_COMMENT_NODE:
-            dump_xml_comment(data, options, buffer, offset, max, depth);
+            xml_writer_add_prefix(w, options, depth);
+            xml_writer_add(w, "<!--", 4);
+            xml_writer_add_str(w, (const char *)data->content);
+            xml_writer_add(w, "-->", 3);
+            if (options & xml_log_option_formatted) {
+                xml_writer_add(w, "\n", 1);
+            }
             break;
+
         default:
-            crm_warn("Unhandled type: %d", data->type);
-            return;
+            if (w->out == NULL) {
+                /* Only complain once, not on both passes */
+                crm_warn("Unhandled type: %d", data->type);
+            }
+            break;
 
             /*
             XML_ATTRIBUTE_NODE = 2
@@ -3859,7 +4476,84 @@ crm_xml_dump(xmlNode * data, int options, char **buffer, int *offset, int *max,
             XML_DOCB_DOCUMENT_NODE = 21
             */
     }
+}
+
+/*!
+ * \internal
+ * \brief Calculate the length of XML as it would be serialized
+ *
+ * \param[in] data     XML to serialize
+ * \param[in] options  Group of enum xml_log_options flags
+ * \param[in] depth    Indentation level of \p data (if formatted)
+ *
+ * \return Number of bytes crm_xml_dump() would add (excluding terminator)
+ */
+size_t
+crm_xml_dump_len(xmlNode * data, int options, int depth)
+{
+    xml_writer_t w = { NULL, 0 };
+
+    if (data) {
+        xml_writer_add_node(&w, data, options, depth);
+    }
+    return w.len;
+}
+
+/*!
+ * \internal
+ * \brief Serialize XML into a caller-supplied buffer
+ *
+ * \param[in]  data     XML to serialize
+ * \param[in]  options  Group of enum xml_log_options flags
+ * \param[in]  depth    Indentation level of \p data (if formatted)
+ * \param[out] out      Where to write; must have room for at least
+ *                      crm_xml_dump_len() + 1 bytes
+ *
+ * \return Number of bytes written (excluding the terminator)
+ */
+size_t
+crm_xml_dump_into(xmlNode * data, int options, int depth, char *out)
+{
+    xml_writer_t w = { out, 0 };
+
+    CRM_ASSERT(out != NULL);
+    if (data) {
+        xml_writer_add_node(&w, data, options, depth);
+    }
+    out[w.len] = 0;
+    return w.len;
+}
+
+void
+crm_xml_dump(xmlNode * data, int options, char **buffer, int *offset, int *max, int depth)
+{
+    size_t len = 0;
+
+    CRM_ASSERT(max != NULL);
+    CRM_ASSERT(offset != NULL);
+    CRM_ASSERT(buffer != NULL);
+
+    if(data == NULL) {
+        *offset = 0;
+        *max = 0;
+        return;
+    }
+
+    if (*buffer == NULL) {
+        *offset = 0;
+        *max = 0;
+    }
+
+    len = crm_xml_dump_len(data, options, depth);
+    if (len == 0) {
+        return;
+    }
 
+    if ((*offset + len + 1) > *max) {
+        *max = *offset + len + 1;
+        *buffer = realloc_safe(*buffer, *max);
+    }
+    *offset += crm_xml_dump_into(data, options, depth, *buffer + *offset);
 }
 
 void
@@ -4079,11 +4773,180 @@ apply_xml_diff(xmlNode *old_xml, xmlNode * diff, xmlNode **new_xml)
     return result;
 }
 
+/* Sibling lookups for __xml_diff_object() on parents with many children.
+ * Matching each child with find_element() and numbering it with
+ * __xml_offset() are both linear, which makes diffing long lists (such as
+ * node_state or lrm_resource entries) quadratic.
+ */
+typedef struct xml_diff_siblings_s {
+    GHashTable *by_key;     /* (tag, id) -> first such child */
+    GHashTable *by_name;    /* tag -> first such child */
+    GHashTable *positions;  /* child -> position in the list + 1 */
+    int *unskipped;         /* Fenwick tree of children without xpf_skip */
+    int n_children;
+} xml_diff_siblings_t;
+
+static void
+__xml_diff_tree_add(xml_diff_siblings_t *siblings, int position, int delta)
+{
+    for (position++; position <= siblings->n_children; position += (position & -position)) {
+        siblings->unskipped[position] += delta;
+    }
+}
+
+static void
+__xml_diff_siblings_free(xml_diff_siblings_t *siblings)
+{
+    if (siblings) {
+        g_hash_table_destroy(siblings->by_key);
+        g_hash_table_destroy(siblings->by_name);
+        g_hash_table_destroy(siblings->positions);
+        free(siblings->unskipped);
+        free(siblings);
+    }
+}
+
+/*!
+ * \internal
+ * \brief Index a node's children for __xml_diff_object()
+ *
+ * \param[in] parent  Node whose children will be matched and numbered
+ *
+ * \return Newly allocated index, or NULL if \p parent has too few children
+ *         to be worth indexing
+ */
+static xml_diff_siblings_t *
+__xml_diff_siblings_new(xmlNode *parent)
+{
+    int n_children = 0;
+    xmlNode *cIter = NULL;
+    xml_diff_siblings_t *siblings = NULL;
+
+    for (cIter = __xml_first_child(parent); cIter != NULL; cIter = __xml_next(cIter)) {
+        if (++n_children > XML_INDEX_MIN_CHILDREN) {
+            break;
+        }
+    }
+    if (n_children <= XML_INDEX_MIN_CHILDREN) {
+        return NULL;
+    }
+
+    siblings = calloc(1, sizeof(xml_diff_siblings_t));
+    CRM_ASSERT(siblings != NULL);
+    siblings->by_key = g_hash_table_new_full(__xml_child_key_hash,
+                                             __xml_child_key_equal, free, NULL);
+    siblings->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    siblings->positions = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    /* Positions count every sibling, as __xml_offset() does */
+    n_children = 0;
+    for (cIter = parent->children; cIter != NULL; cIter = cIter->next) {
+        n_children++;
+    }
+    siblings->n_children = n_children;
+    siblings->unskipped = calloc(n_children + 1, sizeof(int));
+    CRM_ASSERT(siblings->unskipped != NULL);
+
+    n_children = 0;
+    for (cIter = parent->children; cIter != NULL; cIter = cIter->next) {
+        xml_private_t *p = cIter->_private;
+
+        g_hash_table_insert(siblings->positions, cIter,
+                            GINT_TO_POINTER(n_children + 1));
+        if (p && is_not_set(p->flags, xpf_skip)) {
+            __xml_diff_tree_add(siblings, n_children, 1);
+        }
+        n_children++;
+
+        if (cIter->type != XML_TEXT_NODE) {
+            /* Keep the first match, as find_entity() would */
+            __xml_index_insert(siblings->by_key, cIter);
+            if (g_hash_table_lookup(siblings->by_name, cIter->name) == NULL) {
+                g_hash_table_insert(siblings->by_name, (gpointer) cIter->name, cIter);
+            }
+        }
+    }
+    return siblings;
+}
+
+/*!
+ * \internal
+ * \brief Find the child of a node that corresponds to another node
+ *
+ * \param[in] siblings  Index of \p haystack's children (or NULL to search)
+ * \param[in] haystack  Node whose children should be checked
+ * \param[in] needle    Node to match
+ *
+ * \return Same result as find_element(haystack, needle, TRUE)
+ */
+static xmlNode *
+__xml_diff_find(xml_diff_siblings_t *siblings, xmlNode *haystack, xmlNode *needle)
+{
+    const char *id = NULL;
+
+    if (siblings == NULL || needle->type == XML_COMMENT_NODE) {
+        return find_element(haystack, needle, TRUE);
+    }
+
+    id = ID(needle);
+    if (id) {
+        xml_child_key_t key = {
+            (const char *) needle->name, strlen((const char *) needle->name),
+            id, strlen(id)
+        };
+
+        return g_hash_table_lookup(siblings->by_key, &key);
+    }
+    return g_hash_table_lookup(siblings->by_name, needle->name);
+}
+
+/*!
+ * \internal
+ * \brief Same as __xml_offset(), using an index if available
+ */
+static int
+__xml_diff_offset(xml_diff_siblings_t *siblings, xmlNode *xml)
+{
+    int position = 0;
+    int offset = 0;
+
+    if (siblings == NULL) {
+        return __xml_offset(xml);
+    }
+
+    /* Sum of the siblings before this one that are not skipped */
+    position = GPOINTER_TO_INT(g_hash_table_lookup(siblings->positions, xml)) - 1;
+    CRM_CHECK(position >= 0, return __xml_offset(xml));
+    for (; position > 0; position -= (position & -position)) {
+        offset += siblings->unskipped[position];
+    }
+    return offset;
+}
+
+static void
+__xml_diff_skip(xml_diff_siblings_t *siblings, xmlNode *xml)
+{
+    xml_private_t *p = xml->_private;
+
+    if (is_not_set(p->flags, xpf_skip)) {
+        p->flags |= xpf_skip;
+        if (siblings) {
+            int position = GPOINTER_TO_INT(g_hash_table_lookup(siblings->positions, xml));
+
+            if (position > 0) {
+                __xml_diff_tree_add(siblings, position - 1, -1);
+            }
+        }
+    }
+}
+
 static void
 __xml_diff_object(xmlNode *old_xml, xmlNode *new_xml)
 {
     xmlNode *cIter = NULL;
     xmlAttr *pIter = NULL;
+    xml_diff_siblings_t *old_siblings = NULL;
+    xml_diff_siblings_t *new_siblings = NULL;
 
     CRM_CHECK(new_xml != NULL, return);
     if (old_xml == NULL) {
@@ -4191,9 +5054,12 @@ __xml_diff_object(xmlNode *old_xml, xmlNode *new_xml)
         }
     }
 
+    old_siblings = __xml_diff_siblings_new(old_xml);
+    new_siblings = __xml_diff_siblings_new(new_xml);
+
     for (cIter = __xml_first_child(old_xml); cIter != NULL; ) {
         xmlNode *old_child = cIter;
-        xmlNode *new_child = find_element(new_xml, cIter, TRUE);
+        xmlNode *new_child = __xml_diff_find(new_siblings, new_xml, cIter);
 
         cIter = __xml_next(cIter);
         if(new_child) {
@@ -4201,36 +5067,40 @@ __xml_diff_object(xmlNode *old_xml, xmlNode *new_xml)
 
         } else {
             /* Create then free (which will check the acls if necessary) */
+            xmlNode *last = new_xml->last;
             xmlNode *candidate = add_node_copy(new_xml, old_child);
             xmlNode *top = xmlDocGetRootElement(candidate->doc);
 
             __xml_node_clean(candidate);
             __xml_acl_apply(top); /* Make sure any ACLs are applied to 'candidate' */
             /* Record the old position */
-            free_xml_with_position(candidate, __xml_offset(old_child));
+            free_xml_with_position(candidate, __xml_diff_offset(old_siblings, old_child));
 
-            if (find_element(new_xml, old_child, TRUE) == NULL) {
-                xml_private_t *p = old_child->_private;
+            if (new_xml->last != last) {
+                /* The ACLs kept it, so it is now one of the siblings */
+                __xml_diff_siblings_free(new_siblings);
+                new_siblings = __xml_diff_siblings_new(new_xml);
+            }
 
-                p->flags |= xpf_skip;
+            if (__xml_diff_find(new_siblings, new_xml, old_child) == NULL) {
+                __xml_diff_skip(old_siblings, old_child);
             }
         }
     }
 
     for (cIter = __xml_first_child(new_xml); cIter != NULL; ) {
         xmlNode *new_child = cIter;
-        xmlNode *old_child = find_element(old_xml, cIter, TRUE);
+        xmlNode *old_child = __xml_diff_find(old_siblings, old_xml, cIter);
 
         cIter = __xml_next(cIter);
         if(old_child == NULL) {
-            xml_private_t *p = new_child->_private;
-            p->flags |= xpf_skip;
+            __xml_diff_skip(new_siblings, new_child);
             __xml_diff_object(old_child, new_child);
 
         } else {
             /* Check for movement, we already checked for differences */
-            int p_new = __xml_offset(new_child);
-            int p_old = __xml_offset(old_child);
+            int p_new = __xml_diff_offset(new_siblings, new_child);
+            int p_old = __xml_diff_offset(old_siblings, old_child);
 
             if(p_old != p_new) {
                 xml_private_t *p = new_child->_private;
@@ -4241,14 +5111,16 @@ __xml_diff_object(xmlNode *old_xml, xmlNode *new_xml)
                 p->flags |= xpf_moved;
 
                 if(p_old > p_new) {
-                    p = old_child->_private;
+                    __xml_diff_skip(old_siblings, old_child);
                 } else {
-                    p = new_child->_private;
+                    __xml_diff_skip(new_siblings, new_child);
                 }
-                p->flags |= xpf_skip;
             }
         }
     }
+
+    __xml_diff_siblings_free(old_siblings);
+    __xml_diff_siblings_free(new_siblings);
 }
 
 void
@@ -5114,7 +5986,8 @@ crm_next_same_xml(const xmlNode *sibling)
     const char *name = crm_element_name(sibling);
 
     while (match != NULL) {
-        if (!strcmp(crm_element_name(match), name)) {
+        /* Usually the same interned string, if the names match */
+        if ((match->name == sibling->name) || !strcmp(crm_element_name(match), name)) {
             return match;
         }
         match = __xml_next(match);
@@ -5149,7 +6022,25 @@ crm_xml_cleanup(void)
 {
     crm_info("Cleaning up memory from libxml2");
     crm_schema_cleanup();
+    crm_xpath_cleanup();
+
+    /* Documents still in use keep their own reference */
+    if (xml_dict) {
+        xmlDictFree(xml_dict);
+        xml_dict = NULL;
+    }
     xmlCleanupParser();
+
+    /* Release the spare slab, if nothing is still using it */
+    if (xml_private_slabs && xml_private_slabs->used == 0
+        && xml_private_slabs->next == NULL) {
+        free(xml_private_slabs);
+        xml_private_slabs = NULL;
+        xml_alloc_stats.slabs_freed++;
+    }
+    crm_debug("XML private data: %llu allocated, %llu freed, %lu peak, %llu/%llu slabs",
+              xml_alloc_stats.allocs, xml_alloc_stats.frees, xml_alloc_stats.peak,
+              xml_alloc_stats.slabs_freed, xml_alloc_stats.slabs_created);
 }
 
 #define XPATH_MAX 512
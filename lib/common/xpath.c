@@ -19,6 +19,23 @@
 #include <crm_internal.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+#include <libxml/xpathInternals.h>
+
+#include <crm/common/xml_internal.h>
+
+/* Compiled expressions, by expression string */
+static GHashTable *xpath_cache = NULL;
+
+/* Reused for every search, rather than registering all XPath functions anew */
+static xmlXPathContextPtr xpath_context = NULL;
+
+static crm_xpath_cache_stats_t xpath_stats;
+
+/* Callers that embed unique values in their expressions would otherwise grow
+ * the cache without bound, so start over once it gets this big.
+ */
+#define XPATH_CACHE_MAX 256
 
 /*
  * From xpath2.c
@@ -140,29 +157,158 @@ dedupXpathResults(xmlXPathObjectPtr xpathObj)
     }
 }
 
-/* the caller needs to check if the result contains a xmlDocPtr or xmlNodePtr */
-xmlXPathObjectPtr
-xpath_search(xmlNode * xml_top, const char *path)
+static xmlXPathCompExprPtr
+xpath_compile(const char *path)
+{
+    xmlXPathCompExprPtr compiled = NULL;
+
+    if (xpath_cache == NULL) {
+        xpath_cache = g_hash_table_new_full(crm_str_hash, g_str_equal, free,
+                                            (GDestroyNotify) xmlXPathFreeCompExpr);
+    }
+
+    compiled = g_hash_table_lookup(xpath_cache, path);
+    if (compiled) {
+        xpath_stats.hits++;
+        return compiled;
+    }
+
+    xpath_stats.misses++;
+    compiled = xmlXPathCompile((const xmlChar *) path);
+    if (compiled == NULL) {
+        /* libxml2 has already logged why */
+        return NULL;
+    }
+
+    if (g_hash_table_size(xpath_cache) >= XPATH_CACHE_MAX) {
+        crm_trace("Flushing %d compiled XPath expressions",
+                  g_hash_table_size(xpath_cache));
+        xpath_stats.flushes++;
+        g_hash_table_remove_all(xpath_cache);
+    }
+    g_hash_table_insert(xpath_cache, strdup(path), compiled);
+    return compiled;
+}
+
+static xmlXPathObjectPtr
+xpath_search_va(xmlNode * xml_top, const char *path, va_list args)
 {
-    xmlDocPtr doc = NULL;
+    const char *name = NULL;
     xmlXPathObjectPtr xpathObj = NULL;
-    xmlXPathContextPtr xpathCtx = NULL;
-    const xmlChar *xpathExpr = (const xmlChar *)path;
+    xmlXPathCompExprPtr compiled = NULL;
+    va_list unset;
 
     CRM_CHECK(path != NULL, return NULL);
     CRM_CHECK(xml_top != NULL, return NULL);
     CRM_CHECK(strlen(path) > 0, return NULL);
 
-    doc = getDocPtr(xml_top);
+    compiled = xpath_compile(path);
+    if (compiled == NULL) {
+        return NULL;
+    }
+
+    if (xpath_context == NULL) {
+        xpath_context = xmlXPathNewContext(NULL);
+        CRM_ASSERT(xpath_context != NULL);
+    }
+
+    /* Same starting state as a newly created context */
+    xpath_context->doc = getDocPtr(xml_top);
+    xpath_context->node = NULL;
+    xpath_context->contextSize = -1;
+    xpath_context->proximityPosition = -1;
+
+    va_copy(unset, args);
+    for (name = va_arg(args, const char *); name != NULL;
+         name = va_arg(args, const char *)) {
+        const char *value = va_arg(args, const char *);
+
+        xmlXPathRegisterVariable(xpath_context, (const xmlChar *) name,
+                                 xmlXPathNewCString(value? value : ""));
+    }
+
+    xpathObj = xmlXPathCompiledEval(compiled, xpath_context);
+
+    for (name = va_arg(unset, const char *); name != NULL;
+         name = va_arg(unset, const char *)) {
+        (void) va_arg(unset, const char *);
+        xmlXPathRegisterVariable(xpath_context, (const xmlChar *) name, NULL);
+    }
+    va_end(unset);
+
+    xpath_context->doc = NULL;
+    return xpathObj;
+}
+
+/* the caller needs to check if the result contains a xmlDocPtr or xmlNodePtr */
+xmlXPathObjectPtr
+xpath_search(xmlNode * xml_top, const char *path)
+{
+    return crm_xpath_search_with(xml_top, path, NULL);
+}
 
-    xpathCtx = xmlXPathNewContext(doc);
-    CRM_ASSERT(xpathCtx != NULL);
+/*!
+ * \internal
+ * \brief Search XML with an XPath expression that uses variables
+ *
+ * Expressions are compiled once and cached, so rather than formatting
+ * values into a new expression for every search, callers can use an
+ * expression like "//node_state[@uname=$uname]" and supply the values here.
+ * Values need no quoting, and may contain quotes.
+ *
+ * \param[in] xml_top  XML to search
+ * \param[in] path     XPath expression to search with
+ * \param[in] ...      Variable name and value pairs, terminated by NULL
+ *
+ * \return Search results (which the caller must free with freeXpathObject())
+ */
+xmlXPathObjectPtr
+crm_xpath_search_with(xmlNode * xml_top, const char *path, ...)
+{
+    va_list args;
+    xmlXPathObjectPtr xpathObj = NULL;
 
-    xpathObj = xmlXPathEvalExpression(xpathExpr, xpathCtx);
-    xmlXPathFreeContext(xpathCtx);
+    va_start(args, path);
+    xpathObj = xpath_search_va(xml_top, path, args);
+    va_end(args);
     return xpathObj;
 }
 
+/*!
+ * \internal
+ * \brief Get XPath expression cache counters
+ *
+ * \param[out] stats  Where to store the current counter values
+ */
+void
+crm_xpath_cache_stats(crm_xpath_cache_stats_t *stats)
+{
+    CRM_CHECK(stats != NULL, return);
+
+    *stats = xpath_stats;
+    stats->entries = xpath_cache? g_hash_table_size(xpath_cache) : 0;
+}
+
+/*!
+ * \internal
+ * \brief Free the compiled XPath expression cache
+ */
+void
+crm_xpath_cleanup(void)
+{
+    crm_debug("XPath cache: %llu hits, %llu misses, %llu flushes",
+              xpath_stats.hits, xpath_stats.misses, xpath_stats.flushes);
+
+    if (xpath_cache) {
+        g_hash_table_destroy(xpath_cache);
+        xpath_cache = NULL;
+    }
+    if (xpath_context) {
+        xmlXPathFreeContext(xpath_context);
+        xpath_context = NULL;
+    }
+}
+
 /*!
  * \brief Run a supplied function for each result of an xpath search
  *
@@ -216,20 +362,15 @@ get_xpath_object_relative(const char *xpath, xmlNode * xml_obj, int error_level)
     return result;
 }
 
-xmlNode *
-get_xpath_object(const char *xpath, xmlNode * xml_obj, int error_level)
+static xmlNode *
+xpath_single_result(xmlXPathObjectPtr xpathObj, const char *xpath,
+                    xmlNode * xml_obj, int error_level)
 {
     int max;
     xmlNode *result = NULL;
-    xmlXPathObjectPtr xpathObj = NULL;
     char *nodePath = NULL;
     char *matchNodePath = NULL;
 
-    if (xpath == NULL) {
-        return xml_obj;         /* or return NULL? */
-    }
-
-    xpathObj = xpath_search(xml_obj, xpath);
     nodePath = (char *)xmlGetNodePath(xml_obj);
     max = numXpathResults(xpathObj);
 
@@ -263,3 +404,44 @@ get_xpath_object(const char *xpath, xmlNode * xml_obj, int error_level)
 
     return result;
 }
+
+xmlNode *
+get_xpath_object(const char *xpath, xmlNode * xml_obj, int error_level)
+{
+    if (xpath == NULL) {
+        return xml_obj;         /* or return NULL? */
+    }
+
+    return xpath_single_result(xpath_search(xml_obj, xpath), xpath, xml_obj,
+                               error_level);
+}
+
+/*!
+ * \internal
+ * \brief Find the single match for an XPath expression that uses variables
+ *
+ * \param[in] xpath        XPath expression to search with
+ * \param[in] xml_obj      XML to search
+ * \param[in] error_level  Log level for no match or more than one match
+ * \param[in] ...          Variable name and value pairs, terminated by NULL
+ *
+ * \return Matching node if exactly one was found, NULL otherwise
+ * \note See crm_xpath_search_with() for details.
+ */
+xmlNode *
+crm_get_xpath_object_with(const char *xpath, xmlNode * xml_obj,
+                          int error_level, ...)
+{
+    va_list args;
+    xmlXPathObjectPtr xpathObj = NULL;
+
+    if (xpath == NULL) {
+        return xml_obj;
+    }
+
+    va_start(args, error_level);
+    xpathObj = xpath_search_va(xml_obj, xpath, args);
+    va_end(args);
+
+    return xpath_single_result(xpathObj, xpath, xml_obj, error_level);
+}
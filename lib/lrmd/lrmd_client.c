@@ -90,6 +90,10 @@ typedef struct lrmd_private_s {
     int expected_late_replies;
     GList *pending_notify;
     crm_trigger_t *process_notify;
+
+    /* Asynchronous requests still awaiting replies (lrmd_pending_t), keyed by
+     * remote message ID */
+    GHashTable *pending_replies;
 #endif
 
     lrmd_event_callback callback;
@@ -100,6 +104,18 @@ typedef struct lrmd_private_s {
     char *peer_version;
 } lrmd_private_t;
 
+#ifdef HAVE_GNUTLS_GNUTLS_H
+/* An asynchronous request sent to Pacemaker Remote */
+typedef struct lrmd_pending_s {
+    lrmd_t *lrmd;
+    int id;                         /* Remote message ID of request */
+    char *op;                       /* Executor API command requested */
+    guint timer;                    /* Gives up waiting for the reply */
+    lrmd_reply_callback callback;
+    void *user_data;
+} lrmd_pending_t;
+#endif
+
 static lrmd_list_t *
 lrmd_list_add(lrmd_list_t * head, const char *value)
 {
@@ -319,6 +335,119 @@ lrmd_tls_connected(lrmd_t * lrmd)
     return FALSE;
 }
 
+/*!
+ * \internal
+ * \brief Finish an asynchronous request, calling its callback
+ *
+ * \param[in] pending  Request to finish
+ * \param[in] rc       pcmk_ok if a reply was received, -errno otherwise
+ * \param[in] reply    Reply, if any
+ */
+static void
+lrmd_pending_finish(lrmd_pending_t *pending, int rc, xmlNode *reply)
+{
+    if ((rc == pcmk_ok)
+        && (crm_element_value_int(reply, F_LRMD_RC, &rc) != 0)) {
+        rc = -ENOMSG;
+    }
+    crm_trace("Asynchronous %s request %d finished: %s",
+              pending->op, pending->id, pcmk_strerror(rc));
+    if (pending->callback) {
+        pending->callback(pending->lrmd, rc, reply, pending->user_data);
+    }
+}
+
+static void
+lrmd_pending_free(gpointer data)
+{
+    lrmd_pending_t *pending = data;
+
+    if (pending->timer) {
+        g_source_remove(pending->timer);
+    }
+    free(pending->op);
+    free(pending);
+}
+
+/*!
+ * \internal
+ * \brief Pass a reply to the asynchronous request it answers, if any
+ *
+ * \param[in] lrmd   Executor connection reply was received on
+ * \param[in] reply  Reply received
+ *
+ * \return TRUE if reply was for an asynchronous request, FALSE otherwise
+ */
+static gboolean
+lrmd_tls_pending_reply(lrmd_t *lrmd, xmlNode *reply)
+{
+    lrmd_private_t *native = lrmd->lrmd_private;
+    lrmd_pending_t *pending = NULL;
+    int reply_id = 0;
+
+    if (native->pending_replies == NULL) {
+        return FALSE;
+    }
+    crm_element_value_int(reply, F_LRMD_REMOTE_MSG_ID, &reply_id);
+    pending = g_hash_table_lookup(native->pending_replies,
+                                  GINT_TO_POINTER(reply_id));
+    if (pending == NULL) {
+        return FALSE;
+    }
+
+    g_hash_table_steal(native->pending_replies, GINT_TO_POINTER(reply_id));
+    lrmd_pending_finish(pending, pcmk_ok, reply);
+    lrmd_pending_free(pending);
+    return TRUE;
+}
+
+static gboolean
+lrmd_pending_timeout(gpointer data)
+{
+    lrmd_pending_t *pending = data;
+    lrmd_private_t *native = pending->lrmd->lrmd_private;
+
+    crm_err("No reply from Pacemaker Remote to %s request %d",
+            pending->op, pending->id);
+
+    /* Quietly drop the reply if it ever does arrive */
+    native->expected_late_replies++;
+
+    pending->timer = 0;
+    g_hash_table_steal(native->pending_replies, GINT_TO_POINTER(pending->id));
+    lrmd_pending_finish(pending, -ETIME, NULL);
+    lrmd_pending_free(pending);
+    return FALSE;
+}
+
+/*!
+ * \internal
+ * \brief Fail all asynchronous requests still awaiting replies
+ *
+ * \param[in] lrmd  Executor connection that was lost
+ */
+static void
+lrmd_tls_fail_pending(lrmd_t *lrmd)
+{
+    lrmd_private_t *native = lrmd->lrmd_private;
+    GHashTable *pending_replies = native->pending_replies;
+    GHashTableIter iter;
+    lrmd_pending_t *pending = NULL;
+
+    if (pending_replies == NULL) {
+        return;
+    }
+
+    /* Callbacks may send new requests, which must not land in this table */
+    native->pending_replies = NULL;
+
+    g_hash_table_iter_init(&iter, pending_replies);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &pending)) {
+        lrmd_pending_finish(pending, -ENOTCONN, NULL);
+    }
+    g_hash_table_destroy(pending_replies);
+}
+
 static int
 lrmd_tls_dispatch(gpointer userdata)
 {
@@ -342,7 +471,20 @@ lrmd_tls_dispatch(gpointer userdata)
 
         crm_trace("Processing pending notifies");
         for (iter = native->pending_notify; iter; iter = iter->next) {
-            lrmd_dispatch_internal(lrmd, iter->data);
+            if (safe_str_eq(crm_element_value(iter->data,
+                                              F_LRMD_REMOTE_MSG_TYPE),
+                            "reply")) {
+                /* Reply to an asynchronous request, which arrived while
+                 * waiting for a synchronous one. If the request has timed out
+                 * since, the timeout already counted this reply as late.
+                 */
+                if (!lrmd_tls_pending_reply(lrmd, iter->data)
+                    && (native->expected_late_replies > 0)) {
+                    native->expected_late_replies--;
+                }
+            } else {
+                lrmd_dispatch_internal(lrmd, iter->data);
+            }
         }
         g_list_free_full(native->pending_notify, lrmd_free_xml);
         native->pending_notify = NULL;
@@ -364,7 +506,10 @@ lrmd_tls_dispatch(gpointer userdata)
         if (safe_str_eq(msg_type, "notify")) {
             lrmd_dispatch_internal(lrmd, xml);
         } else if (safe_str_eq(msg_type, "reply")) {
-            if (native->expected_late_replies > 0) {
+            if (lrmd_tls_pending_reply(lrmd, xml)) {
+                // Handled by an asynchronous request's callback
+
+            } else if (native->expected_late_replies > 0) {
                 native->expected_late_replies--;
             } else {
                 int reply_id = 0;
@@ -521,6 +666,7 @@ lrmd_tls_connection_destroy(gpointer userdata)
         g_list_free_full(native->pending_notify, lrmd_free_xml);
         native->pending_notify = NULL;
     }
+    lrmd_tls_fail_pending(lrmd);
 
     free(native->remote->buffer);
     native->remote->buffer = NULL;
@@ -614,7 +760,19 @@ lrmd_tls_recv_reply(lrmd_t * lrmd, int total_timeout, int expected_reply_id, int
             free_xml(xml);
             xml = NULL;
         } else if (reply_id != expected_reply_id) {
-            if (native->expected_late_replies > 0) {
+            if (native->pending_replies
+                && g_hash_table_lookup(native->pending_replies,
+                                       GINT_TO_POINTER(reply_id))) {
+                /* Answer to an asynchronous request: handle it later, like
+                 * notifications, rather than from inside this call */
+                native->pending_notify = g_list_append(native->pending_notify, xml);
+                if (native->process_notify) {
+                    mainloop_set_trigger(native->process_notify);
+                }
+                xml = NULL;
+                continue;
+
+            } else if (native->expected_late_replies > 0) {
                 native->expected_late_replies--;
             } else {
                 crm_err("Got outdated reply, expected id %d got id %d", expected_reply_id, reply_id);
@@ -651,6 +809,44 @@ lrmd_tls_send(lrmd_t * lrmd, xmlNode * msg)
     return pcmk_ok;
 }
 
+static int
+lrmd_tls_send_async(lrmd_t *lrmd, xmlNode *msg, const char *op, int timeout,
+                    lrmd_reply_callback callback, void *user_data)
+{
+    int rc = 0;
+    lrmd_private_t *native = lrmd->lrmd_private;
+    lrmd_pending_t *pending = NULL;
+
+    rc = lrmd_tls_send(lrmd, msg);
+    if (rc < 0) {
+        return rc;
+    }
+
+    pending = calloc(1, sizeof(lrmd_pending_t));
+    CRM_ASSERT(pending != NULL);
+    pending->lrmd = lrmd;
+    pending->id = global_remote_msg_id;
+    pending->op = strdup(op);
+    pending->callback = callback;
+    pending->user_data = user_data;
+
+    if (timeout <= 0 || timeout > MAX_TLS_RECV_WAIT) {
+        timeout = MAX_TLS_RECV_WAIT;
+    }
+    pending->timer = g_timeout_add(timeout, lrmd_pending_timeout, pending);
+
+    if (native->pending_replies == NULL) {
+        native->pending_replies = g_hash_table_new_full(g_direct_hash,
+                                                        g_direct_equal, NULL,
+                                                        lrmd_pending_free);
+    }
+    g_hash_table_insert(native->pending_replies, GINT_TO_POINTER(pending->id),
+                        pending);
+    crm_trace("Sent asynchronous %s request %d (%d outstanding)",
+              op, pending->id, g_hash_table_size(native->pending_replies));
+    return pcmk_ok;
+}
+
 static int
 lrmd_tls_send_recv(lrmd_t * lrmd, xmlNode * msg, int timeout, xmlNode ** reply)
 {
@@ -847,6 +1043,75 @@ lrmd_send_command(lrmd_t *lrmd, const char *op, xmlNode *data,
     return rc;
 }
 
+/*!
+ * \internal
+ * \brief Send an API command to the executor without waiting for its reply
+ *
+ * Several such requests may be outstanding on a connection at once. Each
+ * reply is passed to the request's callback as it arrives, from the
+ * mainloop, so the connection must be attached to one.
+ *
+ * \param[in] lrmd       Existing connection to the executor
+ * \param[in] op         Name of API command to send
+ * \param[in] data       Command data XML to add to the sent command
+ * \param[in] timeout    How long (in milliseconds) to wait for the reply (if
+ *                       not positive, wait as long as synchronous requests do)
+ * \param[in] options    Call options to pass to server when sending
+ * \param[in] callback   Called with the result (the reply's return code, or
+ *                       -errno if the reply was never received) and the reply
+ *                       (or NULL), which the callback must not free
+ * \param[in] user_data  Passed to \p callback
+ *
+ * \return pcmk_ok if the request was sent (in which case \p callback will be
+ *         called exactly once), -errno otherwise
+ * \note For local (IPC) connections, the request is synchronous, and
+ *       \p callback is called before this returns.
+ */
+int
+lrmd_internal_send_async(lrmd_t *lrmd, const char *op, xmlNode *data,
+                         int timeout, enum lrmd_call_options options,
+                         lrmd_reply_callback callback, void *user_data)
+{
+    int rc = pcmk_ok;
+    lrmd_private_t *native = lrmd->lrmd_private;
+    xmlNode *reply = NULL;
+#ifdef HAVE_GNUTLS_GNUTLS_H
+    xmlNode *op_msg = NULL;
+#endif
+
+    switch (native->type) {
+        case CRM_CLIENT_IPC:
+            rc = lrmd_send_command(lrmd, op, data, &reply, timeout, options,
+                                   TRUE);
+            if (callback) {
+                callback(lrmd, rc, reply, user_data);
+            }
+            free_xml(reply);
+            return pcmk_ok;
+
+#ifdef HAVE_GNUTLS_GNUTLS_H
+        case CRM_CLIENT_TLS:
+            if (!lrmd_api_is_connected(lrmd)) {
+                return -ENOTCONN;
+            }
+            CRM_CHECK(op != NULL, return -EINVAL);
+
+            op_msg = lrmd_create_op(native->token, op, data, timeout, options);
+            if (op_msg == NULL) {
+                return -EINVAL;
+            }
+            rc = lrmd_tls_send_async(lrmd, op_msg, op, timeout, callback,
+                                     user_data);
+            free_xml(op_msg);
+            return rc;
+#endif
+
+        default:
+            crm_err("Unsupported connection type: %d", native->type);
+    }
+    return -EPROTONOSUPPORT;
+}
+
 static int
 lrmd_api_poke_connection(lrmd_t * lrmd)
 {
@@ -898,6 +1163,11 @@ lrmd_handshake(lrmd_t * lrmd, const char *name)
         crm_xml_add(hello, F_LRMD_IS_IPC_PROVIDER, "true");
     }
 
+    if (native->type == CRM_CLIENT_TLS) {
+        native->remote->codecs = 0; // Until the server says otherwise
+        crm_remote_add_codecs(hello);
+    }
+
     rc = lrmd_send_xml(lrmd, hello, -1, &reply);
 
     if (rc < 0) {
@@ -930,6 +1200,9 @@ lrmd_handshake(lrmd_t * lrmd, const char *name)
             crm_trace("Obtained registration token: %s", tmp_ticket);
             native->token = strdup(tmp_ticket);
             native->peer_version = strdup(version?version:"1.0"); /* Included since 1.1 */
+            if (native->type == CRM_CLIENT_TLS) {
+                crm_remote_set_codecs(native->remote, reply);
+            }
             rc = pcmk_ok;
         }
     }
@@ -1375,6 +1648,7 @@ lrmd_tls_disconnect(lrmd_t * lrmd)
         g_list_free_full(native->pending_notify, lrmd_free_xml);
         native->pending_notify = NULL;
     }
+    lrmd_tls_fail_pending(lrmd);
 }
 #endif
 
@@ -14,6 +14,7 @@
 #include <crm/crm.h>
 #include <crm/msg_xml.h>
 #include <crm/common/xml.h>
+#include <crm/common/xml_internal.h>
 #include <crm/common/util.h>
 #include <crm/pengine/internal.h>
 
@@ -117,7 +118,7 @@ block_failure(node_t *node, resource_t *rsc, xmlNode *xml_op,
                 const char *conf_op_name = NULL;
                 const char *conf_op_interval_spec = NULL;
                 guint conf_op_interval_ms = 0;
-                char *lrm_op_xpath = NULL;
+                char *interval_ms_s = NULL;
                 xmlXPathObject *lrm_op_xpathObj = NULL;
 
                 // Get name and interval from configured op
@@ -125,14 +126,16 @@ block_failure(node_t *node, resource_t *rsc, xmlNode *xml_op,
                 conf_op_interval_spec = crm_element_value(pref, XML_LRM_ATTR_INTERVAL);
                 conf_op_interval_ms = crm_parse_interval_spec(conf_op_interval_spec);
 
-                lrm_op_xpath = crm_strdup_printf("//node_state[@uname='%s']"
-                                               "//lrm_resource[@id='%s']"
-                                               "/lrm_rsc_op[@operation='%s'][@interval='%u']",
-                                               node->details->uname, xml_name,
-                                               conf_op_name, conf_op_interval_ms);
-                lrm_op_xpathObj = xpath_search(data_set->input, lrm_op_xpath);
-
-                free(lrm_op_xpath);
+                interval_ms_s = crm_strdup_printf("%u", conf_op_interval_ms);
+                lrm_op_xpathObj = crm_xpath_search_with(data_set->input,
+                                                        "//node_state[@uname=$uname]"
+                                                        "//lrm_resource[@id=$rsc]"
+                                                        "/lrm_rsc_op[@operation=$op][@interval=$interval]",
+                                                        "uname", node->details->uname,
+                                                        "rsc", xml_name,
+                                                        "op", conf_op_name,
+                                                        "interval", interval_ms_s, NULL);
+                free(interval_ms_s);
 
                 if (lrm_op_xpathObj) {
                     int max2 = numXpathResults(lrm_op_xpathObj);
@@ -15,6 +15,7 @@
 #include <crm/common/xml.h>
 
 #include <crm/common/util.h>
+#include <crm/common/xml_internal.h>
 #include <crm/pengine/rules.h>
 #include <crm/pengine/internal.h>
 #include <unpack.h>
@@ -2283,38 +2284,27 @@ set_node_score(gpointer key, gpointer value, gpointer user_data)
     node->weight = *score;
 }
 
-#define STATUS_PATH_MAX 1024
+#define LRM_OP_XPATH "//node_state[@uname=$node]" \
+                     "//" XML_LRM_TAG_RESOURCE "[@id=$rsc]" \
+                     "/" XML_LRM_TAG_RSC_OP "[@operation=$op"
+
 static xmlNode *
 find_lrm_op(const char *resource, const char *op, const char *node, const char *source,
             pe_working_set_t * data_set)
 {
-    int offset = 0;
-    char xpath[STATUS_PATH_MAX];
-
-    offset += snprintf(xpath + offset, STATUS_PATH_MAX - offset, "//node_state[@uname='%s']", node);
-    offset +=
-        snprintf(xpath + offset, STATUS_PATH_MAX - offset, "//" XML_LRM_TAG_RESOURCE "[@id='%s']",
-                 resource);
+    const char *xpath = LRM_OP_XPATH "]";
 
     /* Need to check against transition_magic too? */
     if (source && safe_str_eq(op, CRMD_ACTION_MIGRATE)) {
-        offset +=
-            snprintf(xpath + offset, STATUS_PATH_MAX - offset,
-                     "/" XML_LRM_TAG_RSC_OP "[@operation='%s' and @migrate_target='%s']", op,
-                     source);
+        xpath = LRM_OP_XPATH " and @migrate_target=$source]";
+
     } else if (source && safe_str_eq(op, CRMD_ACTION_MIGRATED)) {
-        offset +=
-            snprintf(xpath + offset, STATUS_PATH_MAX - offset,
-                     "/" XML_LRM_TAG_RSC_OP "[@operation='%s' and @migrate_source='%s']", op,
-                     source);
-    } else {
-        offset +=
-            snprintf(xpath + offset, STATUS_PATH_MAX - offset,
-                     "/" XML_LRM_TAG_RSC_OP "[@operation='%s']", op);
+        xpath = LRM_OP_XPATH " and @migrate_source=$source]";
     }
 
-    CRM_LOG_ASSERT(offset > 0);
-    return get_xpath_object(xpath, data_set->input, LOG_DEBUG);
+    return crm_get_xpath_object_with(xpath, data_set->input, LOG_DEBUG,
+                                     "node", node, "rsc", resource, "op", op,
+                                     "source", source, NULL);
 }
 
 static bool
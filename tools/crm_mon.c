@@ -305,6 +305,13 @@ cib_connect(gboolean full)
                 rc = cib->cmds->add_notify_callback(cib, T_CIB_DIFF_NOTIFY, crm_diff_update);
             }
 
+            if ((rc == pcmk_ok) && cib->cmds->register_notification) {
+                /* We only need the latest state, so if we fall behind, the
+                 * CIB manager may merge the updates queued for us
+                 */
+                cib->cmds->register_notification(cib, T_CIB_DIFF_COALESCE, 1);
+            }
+
             if (rc != pcmk_ok) {
                 print_as("Notification setup failed, could not monitor CIB actions");
                 if (output_format == mon_output_console) {
@@ -3550,6 +3557,14 @@ crm_diff_update(const char *event, xmlNode * msg)
         refresh_timer = mainloop_timer_add("refresh", 2000, FALSE, mon_trigger_refresh, NULL);
     }
 
+    crm_element_value_int(msg, F_CIB_RC, &rc);
+    if (rc == -pcmk_err_diff_resync) {
+        /* We fell too far behind for the queued updates to be merged */
+        crm_notice("[%s] Updates were dropped, re-reading the CIB", event);
+        free_xml(current_cib); current_cib = NULL;
+        diff = NULL;
+    }
+
     if (current_cib != NULL) {
         rc = xml_apply_patchset(current_cib, diff, TRUE);
 
@@ -3573,7 +3588,7 @@ crm_diff_update(const char *event, xmlNode * msg)
         cib->cmds->query(cib, NULL, &current_cib, cib_scope_local | cib_sync_call);
     }
 
-    if (external_agent) {
+    if (external_agent && diff) {
         int format = 0;
         crm_element_value_int(diff, "format", &format);
         switch(format) {
@@ -3625,7 +3640,7 @@ mon_refresh_display(gpointer user_data)
 
     last_refresh = time(NULL);
 
-    if (cli_config_update(&cib_copy, NULL, FALSE) == FALSE) {
+    if (crm_config_update_trusted(&cib_copy, NULL, FALSE) == FALSE) {
         if (cib) {
             cib->cmds->signoff(cib);
         }
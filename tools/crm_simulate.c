@@ -19,6 +19,7 @@
 #include <crm/crm.h>
 #include <crm/cib.h>
 #include <crm/common/util.h>
+#include <crm/common/xml_internal.h>
 #include <crm/transition.h>
 #include <crm/common/iso8601.h>
 #include <crm/pengine/status.h>
@@ -571,6 +572,20 @@ profile_all(const char *dir)
         free(namelist);
     }
 
+    if (lpc > 0) {
+        crm_xml_alloc_stats_t stats;
+        crm_xpath_cache_stats_t xpath_stats;
+
+        crm_xml_alloc_stats(&stats);
+        printf("* XML private data: %llu allocated, %llu freed, %lu peak,"
+               " %llu slabs\n", stats.allocs, stats.frees, stats.peak,
+               stats.slabs_created);
+
+        crm_xpath_cache_stats(&xpath_stats);
+        printf("* XPath cache: %llu hits, %llu misses, %llu flushes,"
+               " %u cached\n", xpath_stats.hits, xpath_stats.misses,
+               xpath_stats.flushes, xpath_stats.entries);
+    }
     return lpc;
 }
 
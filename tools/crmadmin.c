@@ -55,6 +55,75 @@ const char *crmd_operation = NULL;
 char *dest_node = NULL;
 crm_exit_t exit_code = CRM_EX_OK;
 const char *sys_to = NULL;
+const char *ipc_stats_server = NULL;
+
+/*!
+ * \internal
+ * \brief Print the per-client statistics kept by a local IPC server
+ *
+ * \param[in] server  IPC name of server to query
+ *
+ * \return Exit status
+ */
+static crm_exit_t
+do_ipc_stats(const char *server)
+{
+    int rc = 0;
+    xmlNode *reply = NULL;
+    xmlNode *request = create_xml_node(NULL, __FUNCTION__);
+    crm_ipc_t *ipc = crm_ipc_new(server, 0);
+
+    if ((ipc == NULL) || !crm_ipc_connect(ipc)) {
+        fprintf(stderr, "Could not connect to %s\n", server);
+        crm_ipc_destroy(ipc);
+        free_xml(request);
+        return CRM_EX_UNAVAILABLE;
+    }
+
+    crm_xml_add(request, F_CRM_TASK, CRM_OP_IPC_STATS);
+    rc = crm_ipc_send(ipc, request, crm_ipc_client_response, message_timeout_ms,
+                      &reply);
+    free_xml(request);
+    crm_ipc_close(ipc);
+    crm_ipc_destroy(ipc);
+
+    if ((rc <= 0) || (reply == NULL)) {
+        fprintf(stderr, "No IPC statistics received from %s: %s\n",
+                server, pcmk_strerror(rc));
+        return CRM_EX_ERROR;
+    }
+
+    rc = pcmk_ok;
+    crm_element_value_int(reply, "rc", &rc);
+    if (rc != pcmk_ok) {
+        fprintf(stderr, "No IPC statistics received from %s: %s\n",
+                server, pcmk_strerror(rc));
+        free_xml(reply);
+        return crm_errno2exit(rc);
+    }
+
+    if (BE_SILENT) {
+        xmlNode *client = NULL;
+
+        for (client = __xml_first_child(reply); client != NULL;
+             client = __xml_next(client)) {
+            if (safe_str_neq(crm_element_name(client), "client")) {
+                continue;
+            }
+            printf("%s\t%s\t%s\t%s\n", ID(client),
+                   crm_str(crm_element_value(client, XML_ATTR_UNAME)),
+                   crm_str(crm_element_value(client, "queue-length")),
+                   crm_str(crm_element_value(client, "sent-bytes")));
+        }
+    } else {
+        char *text = dump_xml_formatted(reply);
+
+        printf("%s", text);
+        free(text);
+    }
+    free_xml(reply);
+    return CRM_EX_OK;
+}
 
 /* *INDENT-OFF* */
 static struct crm_option long_options[] = {
@@ -77,6 +146,10 @@ static struct crm_option long_options[] = {
         "(Advanced) Stop the controller (not the rest of the cluster stack) on specified node"
     },
     {"health",    0, 0, 'H', NULL, 1},
+    {
+        "ipc-stats", 1, 0, 'I',
+        "(Advanced) Display per-client IPC statistics of the named local IPC server (for example, cib_ro or crmd)"
+    },
     
     {"-spacer-",	1, 0, '-', "\nAdditional Options:"},
     {XML_ATTR_TIMEOUT, 1, 0, 't', "Time (in milliseconds) to wait before declaring the operation failed"},
@@ -154,6 +227,9 @@ main(int argc, char **argv)
             case 'H':
                 DO_HEALTH = TRUE;
                 break;
+            case 'I':
+                ipc_stats_server = optarg;
+                break;
             default:
                 printf("Argument code 0%o (%c) is not (?yet?) supported\n", flag, flag);
                 ++argerr;
@@ -176,6 +252,11 @@ main(int argc, char **argv)
         crm_help('?', CRM_EX_USAGE);
     }
 
+    if (ipc_stats_server) {
+        exit_code = do_ipc_stats(ipc_stats_server);
+        return crm_exit(exit_code);
+    }
+
     if (do_init()) {
         int res = 0;
 
@@ -0,0 +1,360 @@
+/*
+ * Copyright 2018 Andrew Beekhof <andrew@beekhof.net>
+ *
+ * This source code is licensed under the GNU General Public License version 2
+ * or later (GPLv2+) WITHOUT ANY WARRANTY.
+ */
+
+#include <crm_internal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <crm/crm.h>
+#include <crm/msg_xml.h>
+#include <crm/common/xml.h>
+#include <crm/common/xml_internal.h>
+
+static int iterations = 100;
+
+/* *INDENT-OFF* */
+static struct crm_option long_options[] = {
+    /* Top-level Options */
+    {"help",    0, 0, '?', "\tThis text"},
+    {"version", 0, 0, '$', "\tVersion information"  },
+    {"verbose", 0, 0, 'V', "\tIncrease debug output"},
+
+    {"-spacer-",   0, 0, '-', "\nBenchmarks:"},
+    {"dump",       1, 0, 'd', "\tSerialize the XML in the named file (for example, cts/scheduler/params-6.xml)"},
+    {"compress",   1, 0, 'z', "\tCompress and decompress the XML in the named file with each IPC codec"},
+    {"diff",       1, 0, 'D', "\tDiff generated status sections with up to this many nodes (and resources per node)"},
+
+    {"-spacer-",   0, 0, '-', "\nOptions:"},
+    {"iterations", 1, 0, 'n', "Number of times to repeat each measurement (default 100)"},
+
+    {0, 0, 0, 0}
+};
+/* *INDENT-ON* */
+
+static double
+elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1000.0)
+           + ((now.tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+static void
+report(const char *what, double total_ms, size_t bytes)
+{
+    printf("%-24s %10.3f ms/op %12zu bytes\n", what, total_ms / iterations, bytes);
+}
+
+static int
+bench_dump(const char *filename)
+{
+    int lpc = 0;
+    size_t bytes = 0;
+    struct timespec start;
+    xmlNode *xml = filename2xml(filename);
+
+    if (xml == NULL) {
+        fprintf(stderr, "Could not parse %s\n", filename);
+        return CRM_EX_DATAERR;
+    }
+
+    printf("* Serializing %s (%d iterations)\n", filename, iterations);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (lpc = 0; lpc < iterations; lpc++) {
+        char *buffer = dump_xml_unformatted(xml);
+
+        bytes = strlen(buffer);
+        free(buffer);
+    }
+    report("dump_xml_unformatted", elapsed_ms(&start), bytes);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (lpc = 0; lpc < iterations; lpc++) {
+        char *buffer = dump_xml_formatted(xml);
+
+        bytes = strlen(buffer);
+        free(buffer);
+    }
+    report("dump_xml_formatted", elapsed_ms(&start), bytes);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (lpc = 0; lpc < iterations; lpc++) {
+        free(calculate_xml_versioned_digest(xml, FALSE, TRUE, CRM_FEATURE_SET));
+    }
+    report("v2 digest (filtered)", elapsed_ms(&start),
+           crm_xml_dump_len(xml, xml_log_option_filtered, 0));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (lpc = 0; lpc < iterations; lpc++) {
+        crm_xml_hash(xml);
+    }
+    report("crm_xml_hash", elapsed_ms(&start), 0);
+
+    /* libxml2's own serializer, for reference */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (lpc = 0; lpc < iterations; lpc++) {
+        xmlBuffer *xml_buffer = xmlBufferCreate();
+
+        xmlBufferSetAllocationScheme(xml_buffer, XML_BUFFER_ALLOC_DOUBLEIT);
+        bytes = xmlNodeDump(xml_buffer, xml->doc, xml, 0, 0);
+        xmlBufferFree(xml_buffer);
+    }
+    report("xmlNodeDump", elapsed_ms(&start), bytes);
+
+    free_xml(xml);
+    return CRM_EX_OK;
+}
+
+static int
+bench_compress(const char *filename)
+{
+    int codec = 0;
+    char *buffer = NULL;
+    unsigned int length = 0;
+    xmlNode *xml = filename2xml(filename);
+
+    if (xml == NULL) {
+        fprintf(stderr, "Could not parse %s\n", filename);
+        return CRM_EX_DATAERR;
+    }
+
+    /* Compress what IPC would send */
+    buffer = dump_xml_unformatted(xml);
+    length = strlen(buffer) + 1;
+    free_xml(xml);
+
+    printf("* Compressing %s (%u bytes, %d iterations)\n", filename, length,
+           iterations);
+
+    for (codec = pcmk__codec_bzip2; codec <= pcmk__codec_lz4; codec++) {
+        int lpc = 0;
+        char *what = NULL;
+        char *compressed = NULL;
+        char *uncompressed = NULL;
+        unsigned int compressed_len = 0;
+        struct timespec start;
+
+        if (is_not_set(pcmk__codecs_supported(), pcmk__codec_mask(codec))) {
+            printf("%-24s not supported by this build\n", pcmk__codec_text(codec));
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (lpc = 0; lpc < iterations; lpc++) {
+            free(compressed);
+            compressed = NULL;
+            if (!pcmk__compress(codec, buffer, length, 0, &compressed,
+                                &compressed_len)) {
+                fprintf(stderr, "Could not compress with %s\n",
+                        pcmk__codec_text(codec));
+                free(buffer);
+                return CRM_EX_SOFTWARE;
+            }
+        }
+        what = crm_strdup_printf("%s compress", pcmk__codec_text(codec));
+        report(what, elapsed_ms(&start), compressed_len);
+        free(what);
+
+        uncompressed = malloc(length);
+        CRM_ASSERT(uncompressed != NULL);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (lpc = 0; lpc < iterations; lpc++) {
+            unsigned int uncompressed_len = length;
+
+            if ((pcmk__decompress(codec, compressed, compressed_len,
+                                  uncompressed, &uncompressed_len) != pcmk_ok)
+                || (uncompressed_len != length)) {
+                fprintf(stderr, "Could not decompress with %s\n",
+                        pcmk__codec_text(codec));
+                free(uncompressed);
+                free(compressed);
+                free(buffer);
+                return CRM_EX_SOFTWARE;
+            }
+        }
+        what = crm_strdup_printf("%s decompress", pcmk__codec_text(codec));
+        report(what, elapsed_ms(&start), length);
+        free(what);
+
+        free(uncompressed);
+        free(compressed);
+    }
+
+    free(buffer);
+    return CRM_EX_OK;
+}
+
+static xmlNode *
+generate_status(int n_nodes, int n_resources)
+{
+    int node = 0;
+    int rsc = 0;
+    xmlNode *cib = create_xml_node(NULL, XML_TAG_CIB);
+    xmlNode *status = create_xml_node(cib, XML_CIB_TAG_STATUS);
+
+    for (node = 0; node < n_nodes; node++) {
+        char *uname = crm_strdup_printf("node%d", node);
+        xmlNode *node_state = create_xml_node(status, XML_CIB_TAG_STATE);
+        xmlNode *lrm = create_xml_node(node_state, XML_CIB_TAG_LRM);
+        xmlNode *resources = create_xml_node(lrm, XML_LRM_TAG_RESOURCES);
+
+        crm_xml_add(node_state, XML_ATTR_ID, uname);
+        crm_xml_add(node_state, XML_ATTR_UNAME, uname);
+        crm_xml_add(lrm, XML_ATTR_ID, uname);
+
+        for (rsc = 0; rsc < n_resources; rsc++) {
+            char *id = crm_strdup_printf("rsc%d", rsc);
+            char *op_id = crm_strdup_printf("rsc%d_last_0", rsc);
+            xmlNode *resource = create_xml_node(resources, XML_LRM_TAG_RESOURCE);
+            xmlNode *op = create_xml_node(resource, XML_LRM_TAG_RSC_OP);
+
+            crm_xml_add(resource, XML_ATTR_ID, id);
+            crm_xml_add(resource, XML_AGENT_ATTR_CLASS, "ocf");
+            crm_xml_add(resource, XML_AGENT_ATTR_PROVIDER, "pacemaker");
+            crm_xml_add(resource, XML_ATTR_TYPE, "Dummy");
+            crm_xml_add(op, XML_ATTR_ID, op_id);
+            crm_xml_add(op, XML_LRM_ATTR_TASK, "start");
+            crm_xml_add_int(op, XML_LRM_ATTR_CALLID, rsc);
+            crm_xml_add_int(op, XML_LRM_ATTR_RC, 0);
+            free(op_id);
+            free(id);
+        }
+        free(uname);
+    }
+    return cib;
+}
+
+static int
+bench_diff(int max_size)
+{
+    int size = 0;
+
+    printf("* Diffing generated status sections (%d iterations)\n", iterations);
+
+    /* Each node has as many resources as there are nodes.  In the copy, every
+     * tenth resource has a new call ID and the first one is gone, so every
+     * list has changes, removals and shifted positions.
+     */
+    for (size = 16; size <= max_size; size *= 2) {
+        int lpc = 0;
+        double total_ms = 0;
+        char *what = crm_strdup_printf("%d x %d", size, size);
+        xmlNode *old_xml = generate_status(size, size);
+
+        for (lpc = 0; lpc < iterations; lpc++) {
+            struct timespec start;
+            xmlNode *new_xml = copy_xml(old_xml);
+            xmlNode *node_state = NULL;
+
+            for (node_state = first_named_child(first_named_child(new_xml, XML_CIB_TAG_STATUS),
+                                                XML_CIB_TAG_STATE);
+                 node_state != NULL; node_state = crm_next_same_xml(node_state)) {
+                xmlNode *resources = first_named_child(first_named_child(node_state, XML_CIB_TAG_LRM),
+                                                       XML_LRM_TAG_RESOURCES);
+                xmlNode *resource = first_named_child(resources, XML_LRM_TAG_RESOURCE);
+                int rsc = 0;
+
+                free_xml(resource);
+                for (resource = first_named_child(resources, XML_LRM_TAG_RESOURCE);
+                     resource != NULL; resource = crm_next_same_xml(resource)) {
+                    if (++rsc % 10 == 0) {
+                        crm_xml_add_int(first_named_child(resource, XML_LRM_TAG_RSC_OP),
+                                        XML_LRM_ATTR_CALLID, size + rsc);
+                    }
+                }
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            xml_calculate_changes(old_xml, new_xml);
+            total_ms += elapsed_ms(&start);
+            free_xml(new_xml);
+        }
+        report(what, total_ms, 0);
+        free_xml(old_xml);
+        free(what);
+    }
+    return CRM_EX_OK;
+}
+
+int
+main(int argc, char **argv)
+{
+    int flag = 0;
+    int index = 0;
+    int argerr = 0;
+    crm_exit_t exit_code = CRM_EX_OK;
+    const char *dump_file = NULL;
+    const char *compress_file = NULL;
+    int diff_size = 0;
+
+    crm_log_cli_init("xmlbench");
+    crm_set_options(NULL, "benchmark [options]", long_options,
+                    "Measure the cost of common XML operations");
+
+    if (argc < 2) {
+        argerr++;
+    }
+
+    while (1) {
+        flag = crm_get_option(argc, argv, &index);
+        if (flag == -1)
+            break;
+
+        switch (flag) {
+            case 'V':
+                crm_bump_log_level(argc, argv);
+                break;
+            case '?':
+            case '$':
+                crm_help(flag, CRM_EX_OK);
+                break;
+            case 'd':
+                dump_file = optarg;
+                break;
+            case 'z':
+                compress_file = optarg;
+                break;
+            case 'D':
+                diff_size = crm_parse_int(optarg, "0");
+                if (diff_size < 16) {
+                    ++argerr;
+                }
+                break;
+            case 'n':
+                iterations = crm_parse_int(optarg, "100");
+                if (iterations < 1) {
+                    ++argerr;
+                }
+                break;
+            default:
+                ++argerr;
+                break;
+        }
+    }
+
+    if (argerr) {
+        crm_help('?', CRM_EX_USAGE);
+    }
+
+    if (dump_file) {
+        exit_code = bench_dump(dump_file);
+    }
+    if (compress_file && (exit_code == CRM_EX_OK)) {
+        exit_code = bench_compress(compress_file);
+    }
+    if (diff_size && (exit_code == CRM_EX_OK)) {
+        exit_code = bench_diff(diff_size);
+    }
+
+    crm_exit(exit_code);
+}